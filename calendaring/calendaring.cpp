@@ -21,9 +21,13 @@
 #include <kcalcore/todo.h>
 #include <Qt/qdebug.h>
 #include <kolabevent.h>
+#include <algorithm>
+#include <map>
+#include <set>
 
 #include "conversion/kcalconversion.h"
 #include "conversion/commonconversion.h"
+#include "calendaring/recurrence.h"
 
 namespace Kolab {
 
@@ -31,45 +35,285 @@ namespace Kolab {
 
 bool conflicts(const Kolab::Event &e1, const Kolab::Event &e2)
 {
-    KCalCore::Event::Ptr k1 = Kolab::Conversion::toKCalCore(e1);
-    KCalCore::Event::Ptr k2 = Kolab::Conversion::toKCalCore(e2);
-    if (k2->dtEnd().compare(k1->dtStart()) == KDateTime::Before) {
-        return false;
-    } else if (k1->dtEnd().compare(k2->dtStart()) == KDateTime::Before) {
+    qint64 start1, end1, start2, end2;
+    if (!getTimeSpan(e1, start1, end1) || !getTimeSpan(e2, start2, end2)) {
         return false;
     }
-    return true;
+    return end2 >= start1 && end1 >= start2;
 }
 
+//@cond PRIVATE
+struct ConflictItem
+{
+    qint64 start;
+    qint64 end;
+    //The index within the first list, or within the second list if secondList is true
+    std::size_t index;
+    bool secondList;
+
+    bool operator<(const ConflictItem &other) const
+    {
+        return start < other.start;
+    }
+};
+//@endcond
+
 std::vector< std::vector< Event > > getConflictingSets(const std::vector< Event > &events, const std::vector< Event > &events2)
 {
+    //The time spans are only calculated once, and the overlapping pairs are found with a sweep over the sorted starts
+    std::vector<ConflictItem> items;
+    items.reserve(events.size() + events2.size());
+    for (std::size_t i = 0; i < events.size() + events2.size(); i++) {
+        ConflictItem item;
+        item.secondList = i >= events.size();
+        item.index = item.secondList ? i - events.size() : i;
+        if (getTimeSpan(item.secondList ? events2.at(item.index) : events.at(item.index), item.start, item.end)) {
+            items.push_back(item);
+        }
+    }
+    std::sort(items.begin(), items.end());
+
+    //The conflicting events of each event of the first list, with the events of the second list kept apart
+    std::vector< std::vector<std::size_t> > conflicting(events.size());
+    std::vector< std::vector<std::size_t> > conflicting2(events.size());
+    std::vector<ConflictItem> active;
+    Q_FOREACH (const ConflictItem &item, items) {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < active.size(); i++) {
+            const ConflictItem &other = active[i];
+            //The remaining active events started before and end after the start, so they conflict (inclusive)
+            if (other.end < item.start) {
+                continue;
+            }
+            active[count++] = other;
+            if (item.secondList && other.secondList) {
+                //Conflicts within the second list are not detected
+            } else if (item.secondList) {
+                conflicting2[other.index].push_back(item.index);
+            } else if (other.secondList) {
+                conflicting2[item.index].push_back(other.index);
+            } else {
+                conflicting[qMin(item.index, other.index)].push_back(qMax(item.index, other.index));
+            }
+        }
+        active.resize(count);
+        active.push_back(item);
+    }
+
     std::vector< std::vector< Kolab::Event > > ret;
-    for(std::size_t i = 0; i < events.size(); i++) {
+    for (std::size_t i = 0; i < events.size(); i++) {
+        if (conflicting[i].empty() && conflicting2[i].empty()) {
+            continue;
+        }
+        //Same order as the input lists
+        std::sort(conflicting[i].begin(), conflicting[i].end());
+        std::sort(conflicting2[i].begin(), conflicting2[i].end());
         std::vector<Kolab::Event> set;
-        const Kolab::Event &event = events.at(i);
-        set.push_back(event);
-        for(std::size_t q = i+1; q < events.size(); q++) {
-            const Kolab::Event &e2 = events.at(q);
-            if (conflicts(event, e2)) {
-                set.push_back(e2);
-            }
+        set.reserve(1 + conflicting[i].size() + conflicting2[i].size());
+        set.push_back(events.at(i));
+        Q_FOREACH (std::size_t index, conflicting[i]) {
+            set.push_back(events.at(index));
         }
-        for(std::size_t m = 0; m < events2.size(); m++) {
-            const Kolab::Event &e2 = events2.at(m);
-            if (conflicts(event, e2)) {
-                set.push_back(e2);
+        Q_FOREACH (std::size_t index, conflicting2[i]) {
+            set.push_back(events2.at(index));
+        }
+        ret.push_back(set);
+    }
+    return ret;
+}
+
+
+//@cond PRIVATE
+struct OccurrenceSpan
+{
+    qint64 start;
+    qint64 end;
+    std::size_t event;
+
+    bool operator<(const OccurrenceSpan &other) const
+    {
+        return start < other.start || (start == other.start && event < other.event);
+    }
+};
+//@endcond
+
+/*
+ * Appends the occurrences of the event overlapping with the window, in ascending order.
+ *
+ * Occurrences with a start in skip are left out.
+ */
+static void addOccurrences(const Kolab::Event &event, std::size_t index, qint64 start, qint64 end, const std::set<qint64> &skip, std::vector<OccurrenceSpan> &occurrences)
+{
+    const Recurrence recurrence(event);
+    if (recurrence.isSupported()) {
+        const qint64 duration = recurrence.end() - recurrence.start();
+        RecurrenceIterator it(recurrence, start - duration, end);
+        while (it.hasNext()) {
+            const qint64 time = it.next();
+            if (!skip.count(time)) {
+                const OccurrenceSpan span = { time, time + duration, index };
+                occurrences.push_back(span);
             }
         }
-        if (set.size() > 1) {
-            ret.push_back(set);
+        return;
+    }
+
+    qint64 spanStart, spanEnd;
+    if (!getTimeSpan(event, spanStart, spanEnd)) {
+        return;
+    }
+    const qint64 duration = spanEnd - spanStart;
+    if (!event.recurrenceRule().isValid() && event.recurrenceDates().empty()) {
+        if (spanStart <= end && spanEnd >= start && !skip.count(spanStart)) {
+            const OccurrenceSpan span = { spanStart, spanEnd, index };
+            occurrences.push_back(span);
+        }
+        return;
+    }
+    //Fall back to KCalCore for the recurrences which are not supported natively
+    const KCalCore::Event::Ptr k = Kolab::Conversion::toKCalCore(event);
+    const KCalCore::DateTimeList list = k->recurrence()->timesInInterval(Kolab::Conversion::toDate(fromUtcSeconds(start - duration)), Kolab::Conversion::toDate(fromUtcSeconds(end)));
+    Q_FOREACH (const KDateTime &dt, list) {
+        const qint64 time = dt.isDateOnly() ? toStartSeconds(Kolab::Conversion::fromDate(dt)) : toUtcSeconds(dt);
+        if (time <= end && time + duration >= start && !skip.count(time)) {
+            const OccurrenceSpan span = { time, time + duration, index };
+            occurrences.push_back(span);
         }
     }
-    return ret;
 }
 
+/*
+ * Events belong to the same series if they share a uid, events without uid are each a series of their own.
+ */
+static bool isSameSeries(const std::vector<Kolab::Event> &events, std::size_t first, std::size_t second)
+{
+    if (first == second) {
+        return true;
+    }
+    const std::string &uid = events.at(first).uid();
+    return !uid.empty() && uid == events.at(second).uid();
+}
+
+/*
+ * Expands the occurrences of all events, with the occurrences replaced by exceptions left out.
+ *
+ * The occurrences of each event are sorted, but not the occurrences of all events.
+ */
+static std::vector<OccurrenceSpan> getOccurrences(const std::vector<Kolab::Event> &events, qint64 start, qint64 end)
+{
+    std::map<std::string, std::set<qint64> > recurrenceIds;
+    Q_FOREACH (const Kolab::Event &event, events) {
+        //Exceptions without uid can't be matched to a master
+        if (event.recurrenceID().isValid() && !event.uid().empty()) {
+            recurrenceIds[event.uid()].insert(toStartSeconds(event.recurrenceID()));
+        }
+    }
+    const std::set<qint64> noRecurrenceIds;
+    std::vector<OccurrenceSpan> occurrences;
+    for (std::size_t i = 0; i < events.size(); i++) {
+        const Kolab::Event &event = events.at(i);
+        std::map<std::string, std::set<qint64> >::const_iterator it = recurrenceIds.end();
+        if (!event.recurrenceID().isValid() && !event.uid().empty()) {
+            it = recurrenceIds.find(event.uid());
+        }
+        addOccurrences(event, i, start, end, it != recurrenceIds.end() ? it->second : noRecurrenceIds, occurrences);
+    }
+    return occurrences;
+}
+
+/*
+ * Sweeps over the occurrences sorted by start, and reports the overlapping occurrences of different series.
+ */
+static std::vector<OccurrenceConflict> findConflicts(const std::vector<OccurrenceSpan> &occurrences, const std::vector<Kolab::Event> &events)
+{
+    std::vector<OccurrenceConflict> conflicts;
+    std::vector<OccurrenceSpan> active;
+    Q_FOREACH (const OccurrenceSpan &occurrence, occurrences) {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < active.size(); i++) {
+            const OccurrenceSpan &other = active[i];
+            if (other.end < occurrence.start) {
+                continue;
+            }
+            active[count++] = other;
+            if (isSameSeries(events, other.event, occurrence.event)) {
+                continue;
+            }
+            const bool otherFirst = other.event < occurrence.event;
+            const OccurrenceSpan &first = otherFirst ? other : occurrence;
+            const OccurrenceSpan &second = otherFirst ? occurrence : other;
+            OccurrenceConflict conflict;
+            conflict.first = first.event;
+            conflict.second = second.event;
+            conflict.firstStart = fromUtcSeconds(first.start);
+            conflict.secondStart = fromUtcSeconds(second.start);
+            conflicts.push_back(conflict);
+        }
+        active.resize(count);
+        active.push_back(occurrence);
+    }
+    return conflicts;
+}
+
+static bool getWindow(const Kolab::cDateTime &start, const Kolab::cDateTime &end, qint64 &startSeconds, qint64 &endSeconds)
+{
+    if (!start.isValid() || !end.isValid()) {
+        qWarning() << "invalid window";
+        return false;
+    }
+    startSeconds = toStartSeconds(start);
+    endSeconds = toEndSeconds(end);
+    return true;
+}
+
+std::vector<OccurrenceConflict> getConflictingOccurrences(const std::vector<Kolab::Event> &events, const Kolab::cDateTime &start, const Kolab::cDateTime &end)
+{
+    qint64 startSeconds, endSeconds;
+    if (!getWindow(start, end, startSeconds, endSeconds)) {
+        return std::vector<OccurrenceConflict>();
+    }
+    std::vector<OccurrenceSpan> occurrences = getOccurrences(events, startSeconds, endSeconds);
+    std::sort(occurrences.begin(), occurrences.end());
+    return findConflicts(occurrences, events);
+}
+
+std::vector<OccurrenceConflict> getConflictingOccurrences(const Kolab::Event &e1, const Kolab::Event &e2, const Kolab::cDateTime &start, const Kolab::cDateTime &end)
+{
+    qint64 startSeconds, endSeconds;
+    if (!getWindow(start, end, startSeconds, endSeconds)) {
+        return std::vector<OccurrenceConflict>();
+    }
+    std::vector<Kolab::Event> events;
+    events.push_back(e1);
+    events.push_back(e2);
+    //Both streams are already sorted, so they only need to be merged
+    const std::vector<OccurrenceSpan> occurrences = getOccurrences(events, startSeconds, endSeconds);
+    std::vector<OccurrenceSpan>::const_iterator middle = occurrences.begin();
+    while (middle != occurrences.end() && !middle->event) {
+        ++middle;
+    }
+    std::vector<OccurrenceSpan> merged(occurrences.size());
+    std::merge(occurrences.begin(), middle, middle, occurrences.end(), merged.begin());
+    return findConflicts(merged, events);
+}
 
 std::vector<Kolab::cDateTime> timeInInterval(const Kolab::Event &e, const Kolab::cDateTime &start, const Kolab::cDateTime &end)
 {
+    const Recurrence recurrence(e);
+    if (recurrence.isSupported() && start.isValid() && !start.isDateOnly() && end.isValid() && !end.isDateOnly()) {
+        //Like KCalCore, which returns no times for events without rrules and rdates
+        if (!recurrence.recurs()) {
+            return std::vector<Kolab::cDateTime>();
+        }
+        std::vector<qint64> times;
+        recurrence.timesInInterval(toUtcSeconds(start), toUtcSeconds(end), times);
+        std::vector<Kolab::cDateTime> dtList;
+        dtList.reserve(times.size());
+        Q_FOREACH (qint64 time, times) {
+            dtList.push_back(recurrence.toDateTime(time));
+        }
+        return dtList;
+    }
     KCalCore::Event::Ptr k = Kolab::Conversion::toKCalCore(e);
     KCalCore::DateTimeList list = k->recurrence()->timesInInterval(Kolab::Conversion::toDate(start), Kolab::Conversion::toDate(end));
     std::vector<Kolab::cDateTime> dtList;
@@ -79,35 +323,170 @@ std::vector<Kolab::cDateTime> timeInInterval(const Kolab::Event &e, const Kolab:
     return dtList;
 }
 
+//@cond PRIVATE
+struct CalendarEntry
+{
+    qint64 start;
+    qint64 end;
+    //The maximum end within the subtree of this entry
+    qint64 maxEnd;
+    std::size_t event;
+
+    bool operator<(const CalendarEntry &other) const
+    {
+        return start < other.start || (start == other.start && event < other.event);
+    }
+};
+
+/*
+ * Implicit interval tree over the entries sorted by start.
+ *
+ * The entry at index i is a node of level k if the k lowest bits of i are set, and the k+1-th bit is not set.
+ * Its children are at i - 2^(k-1) and i + 2^(k-1), so no pointers are required and
+ * the entries stay in a single contiguous array (see Heng Li's cgranges).
+ */
+class Calendar::Private
+{
+public:
+    Private()
+    :   dirty(false),
+        maxLevel(-1)
+    {
+    }
+
+    void buildIndex();
+    void query(qint64 start, qint64 end, std::vector<std::size_t> &result) const;
+
+    std::vector<Kolab::Event> events;
+    std::vector<CalendarEntry> entries;
+    bool dirty;
+    int maxLevel;
+};
+//@endcond
+
+void Calendar::Private::buildIndex()
+{
+    std::sort(entries.begin(), entries.end());
+    dirty = false;
+    const qint64 n = entries.size();
+    maxLevel = -1;
+    if (!n) {
+        return;
+    }
+    qint64 lastIndex = 0;
+    qint64 lastMax = 0;
+    for (qint64 i = 0; i < n; i += 2) {
+        lastIndex = i;
+        lastMax = entries[i].maxEnd = entries[i].end;
+    }
+    int k = 1;
+    for (; (Q_INT64_C(1) << k) <= n; k++) {
+        const qint64 x = Q_INT64_C(1) << (k - 1);
+        const qint64 step = x << 2;
+        for (qint64 i = (x << 1) - 1; i < n; i += step) {
+            //The right child may be beyond the end, the maximum of the last subtree is used instead
+            const qint64 left = entries[i - x].maxEnd;
+            const qint64 right = i + x < n ? entries[i + x].maxEnd : lastMax;
+            entries[i].maxEnd = qMax(entries[i].end, qMax(left, right));
+        }
+        lastIndex = (lastIndex >> k & 1) ? lastIndex - x : lastIndex + x;
+        if (lastIndex < n && entries[lastIndex].maxEnd > lastMax) {
+            lastMax = entries[lastIndex].maxEnd;
+        }
+    }
+    maxLevel = k - 1;
+}
+
+/*
+ * Appends the indexes of all events overlapping with the interval (inclusive), in ascending order of the start.
+ */
+void Calendar::Private::query(qint64 start, qint64 end, std::vector<std::size_t> &result) const
+{
+    struct Node {
+        qint64 index;
+        int level;
+        bool leftDone;
+    };
+    if (maxLevel < 0) {
+        return;
+    }
+    const qint64 n = entries.size();
+    //The depth of the traversal is bounded by the number of levels
+    Node stack[128];
+    int top = 0;
+    const Node root = { (Q_INT64_C(1) << maxLevel) - 1, maxLevel, false };
+    stack[top++] = root;
+    while (top) {
+        const Node node = stack[--top];
+        if (node.level <= 3) {
+            //Small subtrees are scanned linearly
+            const qint64 first = node.index >> node.level << node.level;
+            const qint64 last = qMin(n, first + (Q_INT64_C(1) << (node.level + 1)) - 1);
+            for (qint64 i = first; i < last && entries[i].start <= end; i++) {
+                if (entries[i].end >= start) {
+                    result.push_back(entries[i].event);
+                }
+            }
+        } else if (!node.leftDone) {
+            //Process the left subtree first, so the result stays sorted
+            const Node self = { node.index, node.level, true };
+            stack[top++] = self;
+            const qint64 left = node.index - (Q_INT64_C(1) << (node.level - 1));
+            if (left >= n || entries[left].maxEnd >= start) {
+                const Node child = { left, node.level - 1, false };
+                stack[top++] = child;
+            }
+        } else if (node.index < n && entries[node.index].start <= end) {
+            if (entries[node.index].end >= start) {
+                result.push_back(entries[node.index].event);
+            }
+            const Node child = { node.index + (Q_INT64_C(1) << (node.level - 1)), node.level - 1, false };
+            stack[top++] = child;
+        }
+    }
+}
+
 Calendar::Calendar()
-:   mCalendar(new KCalCore::MemoryCalendar(Kolab::Conversion::getTimeSpec(true, std::string()))) //Always utc as it doesn't change anything anyways
+:   d(new Calendar::Private)
+{
+}
+
+Calendar::~Calendar()
 {
 }
 
 void Calendar::addEvent(const Kolab::Event &event)
 {
-    KCalCore::Event::Ptr k = Kolab::Conversion::toKCalCore(event);
-    if (!mCalendar->addEvent(k)) {
+    CalendarEntry entry;
+    if (!getTimeSpan(event, entry.start, entry.end)) {
         qWarning() << "failed to add event";
+        return;
     }
+    entry.maxEnd = entry.end;
+    entry.event = d->events.size();
+    d->events.push_back(event);
+    d->entries.push_back(entry);
+    //The index is rebuilt on the next query, so adding many events doesn't sort repeatedly
+    d->dirty = true;
 }
 
 
 std::vector<Kolab::Event> Calendar::getEvents(const Kolab::cDateTime& start, const Kolab::cDateTime& end, bool sort)
 {
-    const KDateTime s = Kolab::Conversion::toDate(start);
-    const KDateTime e = Kolab::Conversion::toDate(end);
-    const KDateTime::Spec timeSpec = s.timeSpec();
-    KCalCore::Event::List list = mCalendar->events(s.date(), e.date(), timeSpec, true);
-    if (sort) {
-        list = mCalendar->sortEvents(list, KCalCore::EventSortStartDate, KCalCore::SortDirectionAscending);
+    Q_UNUSED(sort);
+    if (!start.isValid() || !end.isValid()) {
+        qWarning() << "invalid interval";
+        return std::vector<Kolab::Event>();
+    }
+    if (d->dirty) {
+        d->buildIndex();
     }
+    std::vector<std::size_t> indexes;
+    d->query(toStartSeconds(start), toEndSeconds(end), indexes);
     std::vector<Kolab::Event> eventlist;
-    foreach (const KCalCore::Event::Ptr &event, list) {
-        //We have to filter the list by time
-        if (event->dtEnd().compare(s) != KDateTime::Before && e.compare(event->dtStart()) != KDateTime::Before) {
-            eventlist.push_back(Kolab::Conversion::fromKCalCore(*event));
-        }
+    eventlist.reserve(indexes.size());
+    Q_FOREACH (std::size_t index, indexes) {
+        eventlist.push_back(d->events.at(index));
     }
     return eventlist;
 }
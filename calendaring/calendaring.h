@@ -26,7 +26,6 @@
 #endif
 
 #include <kcalcore/event.h>
-#include <kcalcore/memorycalendar.h>
 #include <boost/scoped_ptr.hpp>
 #include <kolabevent.h>
 
@@ -50,9 +49,46 @@ KOLAB_EXPORT bool conflicts(const Kolab::Event &, const Kolab::Event &);
  * Conflicts within the second list are not detected.
  *
  * The checked event from the first list comes always first in the returned set.
+ *
+ * The conflicts are found with a sweep over the events sorted by start, in O(n log n + k) for k conflicts.
  */
 KOLAB_EXPORT std::vector< std::vector<Kolab::Event> > getConflictingSets(const std::vector<Kolab::Event> &, const std::vector<Kolab::Event> & = std::vector<Kolab::Event>());
 
+/**
+ * A pair of conflicting occurrences, see getConflictingOccurrences().
+ */
+struct KOLAB_EXPORT OccurrenceConflict {
+    OccurrenceConflict(): first(0), second(0) {}
+    /**
+     * The indexes of the conflicting events, first is always smaller than second.
+     */
+    std::size_t first;
+    std::size_t second;
+    /**
+     * The start of the conflicting occurrence of the first and the second event (in UTC).
+     */
+    Kolab::cDateTime firstStart;
+    Kolab::cDateTime secondStart;
+};
+
+/**
+ * Returns all pairs of overlapping occurrences of different events within the window.
+ * Start and end date/time is inclusive, like for conflicts().
+ *
+ * Only the occurrences overlapping with the window are expanded. The occurrences are sorted by start and checked
+ * with a single sweep, instead of checking every occurrence of each event against every occurrence of the others.
+ * The result is sorted by the start of the overlap.
+ *
+ * Exceptions (events with a recurrence-id) replace the matching occurrence of the event with the same uid,
+ * occurrences of the same uid never conflict with each other. Events without uid are treated as separate series.
+ */
+KOLAB_EXPORT std::vector<OccurrenceConflict> getConflictingOccurrences(const std::vector<Kolab::Event> &, const Kolab::cDateTime &start, const Kolab::cDateTime &end);
+
+/**
+ * Same as above for two events, the result refers to the first event as index 0 and to the second as index 1.
+ */
+KOLAB_EXPORT std::vector<OccurrenceConflict> getConflictingOccurrences(const Kolab::Event &, const Kolab::Event &, const Kolab::cDateTime &start, const Kolab::cDateTime &end);
+
 /**
  * Returns the dates in which the event recurs within the specified timespan.
  */
@@ -60,24 +96,32 @@ KOLAB_EXPORT std::vector<Kolab::cDateTime> timeInInterval(const Kolab::Event &,
 
 /**
  * In-Memory Calendar Cache
+ *
+ * The events are indexed by their start and end in UTC, so range queries take O(log n + k) for k matching events.
  */
 class KOLAB_EXPORT Calendar {
 public:
     explicit Calendar();
+    ~Calendar();
     /**
      * Add an event to the in-memory calendar.
      */
     void addEvent(const Kolab::Event &);
     /**
-     * Returns all events within the specified interval (start and end inclusive).
+     * Returns all events overlapping the specified interval (start and end inclusive).
+     *
+     * Events starting before or ending after the interval are returned as well, unlike in earlier versions,
+     * which only returned events lying completely within the days of the interval.
+     * Recurrences are not taken into account, like for conflicts().
      *
-     * @param sort controls if the resulting event set is sorted in ascending order according to the start date
+     * @param sort is ignored, the result is always sorted in ascending order according to the start date
      */
     std::vector<Kolab::Event> getEvents(const Kolab::cDateTime &start, const Kolab::cDateTime &end, bool sort);
 private:
     Calendar(const Calendar &);
     void operator=(const Calendar &);
-    boost::scoped_ptr<KCalCore::MemoryCalendar> mCalendar;
+    class Private;
+    boost::scoped_ptr<Private> d;
 };
 
     }; //Namespace
@@ -17,3 +17,7 @@
 
 %include "../calendaring/calendaring.h"
 %include "../calendaring/event.h"
+
+namespace std {
+    %template(vectoroccurrenceconflict) vector<Kolab::Calendaring::OccurrenceConflict>;
+};
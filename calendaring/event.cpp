@@ -21,8 +21,10 @@
 #include <kolabformat/kolabobject.h>
 #include <conversion/kcalconversion.h>
 #include <conversion/commonconversion.h>
+#include "calendaring/recurrence.h"
 
 #include <iostream>
+#include <limits>
 #include <kolabformat.h>
 #include <kolabevent_p.h>
 
@@ -208,6 +210,14 @@ Attendee Event::getAttendee(const std::string &s)
 
 cDateTime Calendaring::Event::getNextOccurence(const cDateTime &date)
 {
+    const Recurrence recurrence(*this);
+    if (recurrence.isSupported() && date.isValid() && !date.isDateOnly()) {
+        qint64 next;
+        if (!recurrence.recurs() || !recurrence.nextOccurrence(toUtcSeconds(date), next)) {
+            return cDateTime();
+        }
+        return recurrence.toDateTime(next);
+    }
     KCalCore::Event::Ptr event = Kolab::Conversion::toKCalCore(*this);
     if (!event->recurs()) {
         return cDateTime();
@@ -234,6 +244,108 @@ cDateTime Calendaring::Event::getLastOccurrence() const
     return Kolab::Conversion::fromDate(endDate);
 }
 
+//@cond PRIVATE
+class OccurrenceIterator::Private
+{
+public:
+    Private(const Kolab::Event &e)
+    :   recurrence(e),
+        current(0),
+        valid(false)
+    {
+        if (!recurrence.isSupported()) {
+            //Events which are not supported natively are converted only once
+            event = Kolab::Conversion::toKCalCore(e);
+        }
+    }
+
+    KDateTime firstKCalCoreOccurrence(const KDateTime &date) const;
+
+    //Native expansion
+    const Recurrence recurrence;
+    boost::scoped_ptr<RecurrenceIterator> iterator;
+    qint64 current;
+    bool valid;
+
+    //KCalCore expansion
+    KCalCore::Event::Ptr event;
+    KDateTime currentDate;
+    KDateTime nextDate;
+};
+//@endcond
+
+/*
+ * Returns the first occurrence at or after date.
+ */
+KDateTime OccurrenceIterator::Private::firstKCalCoreOccurrence(const KDateTime &date) const
+{
+    if (!event->recurs()) {
+        return event->dtStart() >= date ? event->dtStart() : KDateTime();
+    }
+    if (event->recurrence()->recursAt(date)) {
+        return date.toTimeSpec(event->dtStart().timeSpec());
+    }
+    return event->recurrence()->getNextDateTime(date);
+}
+
+OccurrenceIterator::OccurrenceIterator(const Kolab::Event &event)
+:   d(new OccurrenceIterator::Private(event))
+{
+    seek(event.start());
+}
+
+OccurrenceIterator::~OccurrenceIterator()
+{
+}
+
+bool OccurrenceIterator::next()
+{
+    if (d->event) {
+        d->currentDate = d->nextDate;
+        if (d->currentDate.isValid()) {
+            d->nextDate = d->event->recurs() ? d->event->recurrence()->getNextDateTime(d->currentDate) : KDateTime();
+        }
+        return d->currentDate.isValid();
+    }
+    d->valid = d->iterator && d->iterator->hasNext();
+    if (d->valid) {
+        d->current = d->iterator->next();
+    }
+    return d->valid;
+}
+
+cDateTime OccurrenceIterator::start() const
+{
+    if (d->event) {
+        return d->currentDate.isValid() ? Kolab::Conversion::fromDate(d->currentDate) : cDateTime();
+    }
+    return d->valid ? d->recurrence.toDateTime(d->current) : cDateTime();
+}
+
+cDateTime OccurrenceIterator::end() const
+{
+    if (d->event) {
+        return d->currentDate.isValid() ? Kolab::Conversion::fromDate(d->event->endDateForStart(d->currentDate)) : cDateTime();
+    }
+    return d->valid ? d->recurrence.toDateTime(d->current + d->recurrence.end() - d->recurrence.start()) : cDateTime();
+}
+
+void OccurrenceIterator::seek(const cDateTime &date)
+{
+    if (d->event) {
+        d->currentDate = KDateTime();
+        d->nextDate = date.isValid() ? d->firstKCalCoreOccurrence(Kolab::Conversion::toDate(date)) : KDateTime();
+        return;
+    }
+    d->valid = false;
+    if (!date.isValid()) {
+        d->iterator.reset();
+        return;
+    }
+    //Only the starts are of interest, the window is open ended
+    d->iterator.reset(new RecurrenceIterator(d->recurrence, toStartSeconds(date), std::numeric_limits<qint64>::max()));
+}
+
 
     };
 };
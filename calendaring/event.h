@@ -20,6 +20,8 @@
 #define EVENT_H
 #include <kolabevent.h>
 
+#include <boost/scoped_ptr.hpp>
+
 #ifndef SWIG
 #include "kolab_export.h"
 #include <icalendar/icalendar.h>
@@ -95,6 +97,7 @@ public:
      * Returns the next occurence for a recurring event.
      *
      * If the start date of the event is passed in, the second occurence is returned (so it can be used in a for loop to loop through all occurences).
+     * Every call expands the recurrence from scratch though, use OccurrenceIterator to loop through many occurences.
      *
      * If there is no next occurence or the event is not recurring at all an invalid cDateTime is returned.
      */
@@ -116,6 +119,53 @@ private:
     Kolab::ITipHandler mITipHandler;
 };
 
+/**
+ * Iterates over the occurences of an event in ascending order.
+ *
+ * The recurrence is only set up once and each step continues where the previous one stopped,
+ * so looping through all occurences is linear (as opposed to repeated calls to Event::getNextOccurence).
+ * Non-recurring events have a single occurence.
+ *
+ * @code
+ * OccurrenceIterator it(event);
+ * while (it.next()) {
+ *     //use it.start() and it.end()
+ * }
+ * @endcode
+ */
+class KOLAB_EXPORT OccurrenceIterator
+{
+public:
+    explicit OccurrenceIterator(const Kolab::Event &);
+    ~OccurrenceIterator();
+
+    /**
+     * Moves to the next occurence.
+     *
+     * Returns false if there are no further occurences.
+     */
+    bool next();
+
+    /**
+     * The start and end date-time of the current occurence (same as Event::getOccurenceEndDate()).
+     *
+     * Both are invalid before the first call to next(), and after the last occurence.
+     */
+    Kolab::cDateTime start() const;
+    Kolab::cDateTime end() const;
+
+    /**
+     * Moves before the first occurence starting at or after @param date, so the next call to next() returns it.
+     */
+    void seek(const Kolab::cDateTime &date);
+
+private:
+    OccurrenceIterator(const OccurrenceIterator &);
+    void operator=(const OccurrenceIterator &);
+    class Private;
+    boost::scoped_ptr<Private> d;
+};
+
     };
 };
 
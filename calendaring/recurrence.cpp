@@ -0,0 +1,738 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recurrence.h"
+
+#include "conversion/commonconversion.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+namespace Kolab {
+    namespace Calendaring {
+
+//Days since 1970-01-01 in the proleptic gregorian calendar
+static qint64 daysFromCivil(int year, int month, int day)
+{
+    const qint64 y = month <= 2 ? year - 1 : year;
+    const qint64 era = (y >= 0 ? y : y - 399) / 400;
+    const qint64 yoe = y - era * 400;
+    const qint64 doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const qint64 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static void civilFromDays(qint64 days, int &year, int &month, int &day)
+{
+    days += 719468;
+    const qint64 era = (days >= 0 ? days : days - 146096) / 146097;
+    const qint64 doe = days - era * 146097;
+    const qint64 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const qint64 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const qint64 mp = (5 * doy + 2) / 153;
+    day = doy - (153 * mp + 2) / 5 + 1;
+    month = mp < 10 ? mp + 3 : mp - 9;
+    year = yoe + era * 400 + (month <= 2 ? 1 : 0);
+}
+
+static const qint64 secondsPerDay = 86400;
+
+qint64 toUtcSeconds(const Kolab::cDateTime &dt)
+{
+    Q_ASSERT(dt.isValid() && !dt.isDateOnly());
+    if (!dt.isUTC()) {
+        return toUtcSeconds(Kolab::Conversion::toDate(dt));
+    }
+    return daysFromCivil(dt.year(), dt.month(), dt.day()) * secondsPerDay + dt.hour() * 3600 + dt.minute() * 60 + dt.second();
+}
+
+qint64 toUtcSeconds(const KDateTime &dt)
+{
+    Q_ASSERT(dt.isValid() && !dt.isDateOnly());
+    const KDateTime utc = dt.toUtc();
+    const QDate &date = utc.date();
+    const QTime &time = utc.time();
+    return daysFromCivil(date.year(), date.month(), date.day()) * secondsPerDay + time.hour() * 3600 + time.minute() * 60 + time.second();
+}
+
+Kolab::cDateTime fromUtcSeconds(qint64 seconds)
+{
+    qint64 days = seconds / secondsPerDay;
+    qint64 rest = seconds % secondsPerDay;
+    if (rest < 0) {
+        rest += secondsPerDay;
+        days--;
+    }
+    int year, month, day;
+    civilFromDays(days, year, month, day);
+    return Kolab::cDateTime(year, month, day, rest / 3600, (rest % 3600) / 60, rest % 60, true);
+}
+
+static KDateTime toStartOfDay(const Kolab::cDateTime &dt)
+{
+    return KDateTime(QDate(dt.year(), dt.month(), dt.day()), QTime(0, 0, 0), KDateTime::Spec(KDateTime::ClockTime));
+}
+
+qint64 toStartSeconds(const Kolab::cDateTime &dt)
+{
+    if (dt.isDateOnly()) {
+        return toUtcSeconds(toStartOfDay(dt));
+    }
+    return toUtcSeconds(dt);
+}
+
+qint64 toEndSeconds(const Kolab::cDateTime &dt)
+{
+    if (dt.isDateOnly()) {
+        return toUtcSeconds(toStartOfDay(dt).addDays(1)) - 1;
+    }
+    return toUtcSeconds(dt);
+}
+
+bool getTimeSpan(const Kolab::Event &event, qint64 &start, qint64 &end)
+{
+    const Kolab::cDateTime &dtStart = event.start();
+    if (!dtStart.isValid()) {
+        return false;
+    }
+    start = toStartSeconds(dtStart);
+    const Kolab::Duration &duration = event.duration();
+    if (event.end().isValid()) {
+        end = toEndSeconds(event.end());
+    } else if (duration.isValid()) {
+        const int sign = duration.isNegative() ? -1 : 1;
+        const int days = sign * (duration.weeks() * 7 + duration.days());
+        const int seconds = sign * ((duration.hours() * 60 + duration.minutes()) * 60 + duration.seconds());
+        if (dtStart.isDateOnly()) {
+            //The duration includes the end day of all-day events
+            const KDateTime startOfDay = toStartOfDay(dtStart);
+            end = qMax(toUtcSeconds(startOfDay.addDays(days).addSecs(seconds)) - 1, toEndSeconds(dtStart));
+        } else {
+            end = toUtcSeconds(Kolab::Conversion::toDate(dtStart).addDays(days).addSecs(seconds));
+        }
+    } else {
+        end = toEndSeconds(dtStart);
+    }
+    //Events ending before they start are treated as instantaneous
+    end = qMax(start, end);
+    return true;
+}
+
+static bool isDateTime(const Kolab::cDateTime &dt)
+{
+    return dt.isValid() && !dt.isDateOnly();
+}
+
+static bool hasUnsupportedByRules(const Kolab::RecurrenceRule &rrule)
+{
+    return !rrule.bysecond().empty() || !rrule.byminute().empty() || !rrule.byhour().empty() ||
+           !rrule.byyearday().empty() || !rrule.byweekno().empty();
+}
+
+//Qt day of week, 1 is monday
+static int toDayOfWeek(Kolab::Weekday weekday)
+{
+    switch (weekday) {
+        case Kolab::Tuesday:
+            return 2;
+        case Kolab::Wednesday:
+            return 3;
+        case Kolab::Thursday:
+            return 4;
+        case Kolab::Friday:
+            return 5;
+        case Kolab::Saturday:
+            return 6;
+        case Kolab::Sunday:
+            return 7;
+        default:
+            return 1;
+    }
+}
+
+static qint64 floorDiv(qint64 value, qint64 divisor)
+{
+    const qint64 result = value / divisor;
+    return (value % divisor < 0) ? result - 1 : result;
+}
+
+//Qt day of week, 1970-01-01 was a thursday
+static int dayOfWeek(qint64 day)
+{
+    return day + 3 - floorDiv(day + 3, 7) * 7 + 1;
+}
+
+static qint64 dayFromDate(const QDate &date)
+{
+    return daysFromCivil(date.year(), date.month(), date.day());
+}
+
+static int daysInMonth(int year, int month)
+{
+    return QDate(year, month, 1).daysInMonth();
+}
+
+//Guards against rules that never match, like the 30th of february
+static const int maxEmptyPeriods = 5000;
+static const int maxYear = 9999;
+static const qint64 maxDay = daysFromCivil(maxYear, 12, 31);
+
+Recurrence::Recurrence(const Kolab::Event &event)
+:   mSupported(false),
+    mRecurs(false),
+    mUtc(true),
+    mStart(0),
+    mEnd(0),
+    mFrequency(Kolab::RecurrenceRule::Daily),
+    mInterval(1),
+    mCount(1),
+    mHasUntil(false),
+    mUntil(0),
+    mWeekStart(1),
+    mStartDay(0),
+    mStartWeek(0),
+    mStartYear(0),
+    mStartMonth(0),
+    mStartDayOfMonth(0),
+    mStartDayOfWeek(0),
+    mTimeOfDay(0)
+{
+    if (!isDateTime(event.start())) {
+        return;
+    }
+    //KCalCore takes the duration into account as well, which is not implemented here
+    if (event.end().isValid() ? event.end().isDateOnly() : event.duration().isValid()) {
+        return;
+    }
+
+    const Kolab::RecurrenceRule &rrule = event.recurrenceRule();
+    if (rrule.isValid()) {
+        if (rrule.interval() < 1 || hasUnsupportedByRules(rrule)) {
+            return;
+        }
+        mFrequency = rrule.frequency();
+        if (mFrequency != Kolab::RecurrenceRule::Daily && mFrequency != Kolab::RecurrenceRule::Weekly &&
+            mFrequency != Kolab::RecurrenceRule::Monthly && mFrequency != Kolab::RecurrenceRule::Yearly) {
+            return;
+        }
+        mInterval = rrule.interval();
+        mWeekStart = toDayOfWeek(rrule.weekStart());
+        Q_FOREACH (const Kolab::DayPos &dayPos, rrule.byday()) {
+            //Positions are only supported within a month
+            if (dayPos.occurence() && mFrequency != Kolab::RecurrenceRule::Monthly &&
+                (mFrequency != Kolab::RecurrenceRule::Yearly || rrule.bymonth().empty())) {
+                return;
+            }
+            mByDay.push_back(std::make_pair(dayPos.occurence(), toDayOfWeek(dayPos.weekday())));
+        }
+        mByMonthDay = rrule.bymonthday();
+        mByMonth = rrule.bymonth();
+        if (mFrequency == Kolab::RecurrenceRule::Weekly && !mByMonthDay.empty()) {
+            return;
+        }
+        //Without BYMONTH, BYDAY and BYMONTHDAY would apply to the whole year
+        if (mFrequency == Kolab::RecurrenceRule::Yearly && mByMonth.empty() && (!mByDay.empty() || !mByMonthDay.empty())) {
+            return;
+        }
+        if (rrule.end().isValid()) {
+            if (rrule.end().isDateOnly()) {
+                return;
+            }
+            mHasUntil = true;
+            mUntil = toUtcSeconds(rrule.end());
+            mCount = 0;
+        } else {
+            //A count of 0 and no end means the event recurs indefinitely
+            mCount = rrule.count();
+        }
+        mRecurs = true;
+    }
+
+    const Kolab::cDateTime &start = event.start();
+    mStart = toUtcSeconds(start);
+    mEnd = event.end().isValid() ? toUtcSeconds(event.end()) : mStart;
+    mUtc = start.isUTC();
+    //The occurrences are calculated in local time, so they keep the local time over daylight saving time changes
+    mLocalTime = QTime(start.hour(), start.minute(), start.second());
+    mTimeOfDay = start.hour() * 3600 + start.minute() * 60 + start.second();
+    if (!mUtc) {
+        mSpec = Kolab::Conversion::getTimeSpec(false, start.timezone());
+    }
+    mStartYear = start.year();
+    mStartMonth = start.month();
+    mStartDayOfMonth = start.day();
+    mStartDay = daysFromCivil(mStartYear, mStartMonth, mStartDayOfMonth);
+    mStartDayOfWeek = dayOfWeek(mStartDay);
+    mStartWeek = mStartDay - (mStartDayOfWeek - mWeekStart + 7) % 7;
+
+    Q_FOREACH (const Kolab::cDateTime &rdate, event.recurrenceDates()) {
+        if (!rdate.isValid()) {
+            continue;
+        }
+        Candidate candidate;
+        if (rdate.isDateOnly()) {
+            //Date-only rdates use the time of the start date
+            candidate.day = daysFromCivil(rdate.year(), rdate.month(), rdate.day());
+            candidate.time = toTime(candidate.day);
+        } else {
+            candidate.time = toUtcSeconds(rdate);
+            candidate.day = toDay(candidate.time);
+        }
+        mRDates.push_back(candidate);
+        mRecurs = true;
+    }
+    std::sort(mRDates.begin(), mRDates.end());
+    std::vector<Candidate> rdates;
+    Q_FOREACH (const Candidate &candidate, mRDates) {
+        if (rdates.empty() || rdates.back().time != candidate.time) {
+            rdates.push_back(candidate);
+        }
+    }
+    mRDates.swap(rdates);
+
+    Q_FOREACH (const Kolab::cDateTime &exdate, event.exceptionDates()) {
+        if (!exdate.isValid()) {
+            continue;
+        }
+        //Date-only exdates exclude all occurrences on that day
+        if (exdate.isDateOnly()) {
+            mExDays.push_back(daysFromCivil(exdate.year(), exdate.month(), exdate.day()));
+        } else {
+            mExTimes.push_back(toUtcSeconds(exdate));
+        }
+    }
+    std::sort(mExDays.begin(), mExDays.end());
+    std::sort(mExTimes.begin(), mExTimes.end());
+
+    //KCalCore handles start dates which don't match the rule differently than RFC 5545, so they are left to KCalCore
+    std::vector<Candidate> first;
+    if (!expandPeriod(0, first) || first.empty() || first.front().time != mStart) {
+        return;
+    }
+    mSupported = true;
+}
+
+bool Recurrence::isSupported() const
+{
+    return mSupported;
+}
+
+bool Recurrence::recurs() const
+{
+    return mRecurs;
+}
+
+qint64 Recurrence::start() const
+{
+    return mStart;
+}
+
+qint64 Recurrence::end() const
+{
+    return mEnd;
+}
+
+qint64 Recurrence::toTime(qint64 day) const
+{
+    if (mUtc) {
+        return day * secondsPerDay + mTimeOfDay;
+    }
+    int year, month, dayOfMonth;
+    civilFromDays(day, year, month, dayOfMonth);
+    return toUtcSeconds(KDateTime(QDate(year, month, dayOfMonth), mLocalTime, mSpec));
+}
+
+qint64 Recurrence::toDay(qint64 time) const
+{
+    if (mUtc) {
+        return floorDiv(time, secondsPerDay);
+    }
+    return dayFromDate(Kolab::Conversion::toDate(fromUtcSeconds(time)).toTimeSpec(mSpec).date());
+}
+
+Kolab::cDateTime Recurrence::toDateTime(qint64 time) const
+{
+    if (mUtc) {
+        return fromUtcSeconds(time);
+    }
+    return Kolab::Conversion::fromDate(Kolab::Conversion::toDate(fromUtcSeconds(time)).toTimeSpec(mSpec));
+}
+
+/*
+ * Only used for daily recurrences, where the BY* rules limit the days instead of expanding them.
+ */
+bool Recurrence::matchesDay(qint64 day) const
+{
+    if (mByMonth.empty() && mByMonthDay.empty() && mByDay.empty()) {
+        return true;
+    }
+    int year, month, dayOfMonth;
+    civilFromDays(day, year, month, dayOfMonth);
+    if (!mByMonth.empty() && std::find(mByMonth.begin(), mByMonth.end(), month) == mByMonth.end()) {
+        return false;
+    }
+    if (!mByMonthDay.empty()) {
+        const int fromEnd = dayOfMonth - daysInMonth(year, month) - 1;
+        if (std::find(mByMonthDay.begin(), mByMonthDay.end(), dayOfMonth) == mByMonthDay.end() &&
+            std::find(mByMonthDay.begin(), mByMonthDay.end(), fromEnd) == mByMonthDay.end()) {
+            return false;
+        }
+    }
+    if (!mByDay.empty()) {
+        const int weekday = dayOfWeek(day);
+        bool found = false;
+        for (std::size_t i = 0; i < mByDay.size(); i++) {
+            found = found || mByDay[i].second == weekday;
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Appends the days of the month matching BYMONTHDAY and BYDAY (or the day of the start date if there are none).
+ */
+void Recurrence::addMonthDays(int year, int month, std::vector<qint64> &days) const
+{
+    const int length = daysInMonth(year, month);
+    const qint64 firstDay = daysFromCivil(year, month, 1);
+    std::vector<int> monthDays;
+    Q_FOREACH (int monthDay, mByMonthDay) {
+        const int d = monthDay > 0 ? monthDay : length + monthDay + 1;
+        if (d >= 1 && d <= length) {
+            monthDays.push_back(d);
+        }
+    }
+    std::vector<int> weekDays;
+    const int firstWeekday = dayOfWeek(firstDay);
+    for (std::size_t i = 0; i < mByDay.size(); i++) {
+        const int position = mByDay[i].first;
+        const int weekday = mByDay[i].second;
+        const int first = 1 + (weekday - firstWeekday + 7) % 7;
+        if (!position) {
+            for (int d = first; d <= length; d += 7) {
+                weekDays.push_back(d);
+            }
+        } else if (position > 0) {
+            const int d = first + (position - 1) * 7;
+            if (d <= length) {
+                weekDays.push_back(d);
+            }
+        } else {
+            const int last = first + (length - first) / 7 * 7;
+            const int d = last + (position + 1) * 7;
+            if (d >= 1) {
+                weekDays.push_back(d);
+            }
+        }
+    }
+
+    std::vector<int> result;
+    if (!mByMonthDay.empty() && !mByDay.empty()) {
+        //Both rules have to match
+        std::sort(monthDays.begin(), monthDays.end());
+        std::sort(weekDays.begin(), weekDays.end());
+        std::set_intersection(monthDays.begin(), monthDays.end(), weekDays.begin(), weekDays.end(), std::back_inserter(result));
+    } else if (!mByMonthDay.empty()) {
+        result = monthDays;
+    } else if (!mByDay.empty()) {
+        result = weekDays;
+    } else if (mStartDayOfMonth <= length) {
+        //Months without this day are skipped
+        result.push_back(mStartDayOfMonth);
+    }
+    Q_FOREACH (int d, result) {
+        days.push_back(firstDay + d - 1);
+    }
+}
+
+/*
+ * Returns the candidates of the rule within the period, in ascending order.
+ *
+ * A period is the interval'th day, week, month or year after the start date.
+ * Candidates before the start date are left out. Returns false if the period is out of range.
+ */
+bool Recurrence::expandPeriod(int period, std::vector<Candidate> &candidates) const
+{
+    candidates.clear();
+    std::vector<qint64> days;
+    const qint64 step = static_cast<qint64>(period) * mInterval;
+    switch (mFrequency) {
+        case Kolab::RecurrenceRule::Daily: {
+            const qint64 day = mStartDay + step;
+            if (day > maxDay) {
+                return false;
+            }
+            if (matchesDay(day)) {
+                days.push_back(day);
+            }
+            break;
+        }
+        case Kolab::RecurrenceRule::Weekly: {
+            const qint64 week = mStartWeek + step * 7;
+            if (week > maxDay) {
+                return false;
+            }
+            if (mByDay.empty()) {
+                days.push_back(week + (mStartDayOfWeek - mWeekStart + 7) % 7);
+            }
+            for (std::size_t i = 0; i < mByDay.size(); i++) {
+                days.push_back(week + (mByDay[i].second - mWeekStart + 7) % 7);
+            }
+            if (!mByMonth.empty()) {
+                std::vector<qint64> filtered;
+                Q_FOREACH (qint64 day, days) {
+                    int year, month, dayOfMonth;
+                    civilFromDays(day, year, month, dayOfMonth);
+                    if (std::find(mByMonth.begin(), mByMonth.end(), month) != mByMonth.end()) {
+                        filtered.push_back(day);
+                    }
+                }
+                days = filtered;
+            }
+            break;
+        }
+        case Kolab::RecurrenceRule::Monthly: {
+            const qint64 months = mStartMonth - 1 + step;
+            const int year = mStartYear + months / 12;
+            const int month = months % 12 + 1;
+            if (year > maxYear) {
+                return false;
+            }
+            if (mByMonth.empty() || std::find(mByMonth.begin(), mByMonth.end(), month) != mByMonth.end()) {
+                addMonthDays(year, month, days);
+            }
+            break;
+        }
+        case Kolab::RecurrenceRule::Yearly: {
+            const qint64 year = mStartYear + step;
+            if (year > maxYear) {
+                return false;
+            }
+            std::vector<int> months = mByMonth;
+            if (months.empty()) {
+                months.push_back(mStartMonth);
+            }
+            std::sort(months.begin(), months.end());
+            Q_FOREACH (int month, months) {
+                if (month >= 1 && month <= 12) {
+                    addMonthDays(year, month, days);
+                }
+            }
+            break;
+        }
+        default:
+            return false;
+    }
+    std::sort(days.begin(), days.end());
+    days.erase(std::unique(days.begin(), days.end()), days.end());
+    Q_FOREACH (qint64 day, days) {
+        if (day < mStartDay) {
+            continue;
+        }
+        Candidate candidate;
+        candidate.day = day;
+        candidate.time = toTime(day);
+        if (candidate.time >= mStart) {
+            candidates.push_back(candidate);
+        }
+    }
+    return true;
+}
+
+/*
+ * Returns a period that starts before the first occurrence at or after time, without iterating over the previous periods.
+ */
+int Recurrence::firstPeriod(qint64 time) const
+{
+    //Two days earlier, so the offset of the timezone doesn't matter
+    const qint64 day = floorDiv(time, secondsPerDay) - 2;
+    if (day <= mStartDay) {
+        return 0;
+    }
+    int year, month, dayOfMonth;
+    civilFromDays(day, year, month, dayOfMonth);
+    qint64 units = 0;
+    switch (mFrequency) {
+        case Kolab::RecurrenceRule::Daily:
+            units = day - mStartDay;
+            break;
+        case Kolab::RecurrenceRule::Weekly:
+            units = (day - mStartWeek) / 7;
+            break;
+        case Kolab::RecurrenceRule::Monthly:
+            units = (year * 12 + month) - (mStartYear * 12 + mStartMonth);
+            break;
+        default:
+            units = year - mStartYear;
+    }
+    return qMin(units / mInterval, static_cast<qint64>(std::numeric_limits<int>::max()));
+}
+
+/*
+ * Returns a time before all candidates of the period.
+ */
+qint64 Recurrence::periodStart(int period) const
+{
+    const qint64 step = static_cast<qint64>(period) * mInterval;
+    qint64 day;
+    switch (mFrequency) {
+        case Kolab::RecurrenceRule::Daily:
+            day = mStartDay + step;
+            break;
+        case Kolab::RecurrenceRule::Weekly:
+            day = mStartWeek + step * 7;
+            break;
+        case Kolab::RecurrenceRule::Monthly: {
+            const qint64 months = mStartMonth - 1 + step;
+            day = daysFromCivil(qMin(mStartYear + months / 12, static_cast<qint64>(maxYear + 1)), months % 12 + 1, 1);
+            break;
+        }
+        default:
+            day = daysFromCivil(qMin(mStartYear + step, static_cast<qint64>(maxYear + 1)), 1, 1);
+    }
+    return (day - 2) * secondsPerDay;
+}
+
+bool Recurrence::isExcluded(const Candidate &candidate) const
+{
+    return (!mExTimes.empty() && std::binary_search(mExTimes.begin(), mExTimes.end(), candidate.time)) ||
+           (!mExDays.empty() && std::binary_search(mExDays.begin(), mExDays.end(), candidate.day));
+}
+
+void Recurrence::timesInInterval(qint64 start, qint64 end, std::vector<qint64> &result) const
+{
+    result.clear();
+    RecurrenceIterator it(*this, start, end);
+    while (it.hasNext()) {
+        result.push_back(it.next());
+    }
+}
+
+bool Recurrence::nextOccurrence(qint64 time, qint64 &next) const
+{
+    RecurrenceIterator it(*this, time + 1, std::numeric_limits<qint64>::max());
+    if (!it.hasNext()) {
+        return false;
+    }
+    next = it.next();
+    return true;
+}
+
+RecurrenceIterator::RecurrenceIterator(const Recurrence &recurrence, qint64 start, qint64 end)
+:   mRecurrence(recurrence),
+    mStart(start),
+    mEnd(end),
+    //With a count all occurrences from the start have to be counted
+    mPeriod(recurrence.mCount > 0 ? 0 : recurrence.firstPeriod(start)),
+    mCount(0),
+    mEmptyPeriods(0),
+    mPos(0),
+    mRuleDone(!recurrence.isSupported()),
+    mHasRuleNext(false),
+    mRuleNext(0),
+    mRDatePos(0),
+    mHasNext(false),
+    mNext(0)
+{
+    if (!recurrence.isSupported()) {
+        mRDatePos = recurrence.mRDates.size();
+    }
+    fetch();
+}
+
+/*
+ * Returns the next occurrence of the rule (including the start date) within the window, which is not excluded.
+ */
+bool RecurrenceIterator::nextRuleOccurrence(qint64 &time)
+{
+    const Recurrence &r = mRecurrence;
+    while (!mRuleDone) {
+        if (mPos < mBuffer.size()) {
+            const Recurrence::Candidate &candidate = mBuffer[mPos++];
+            if (r.mCount > 0 && mCount >= r.mCount) {
+                break;
+            }
+            mCount++;
+            //The first occurrence is always the start date, even if it is after the until date
+            if (candidate.time > mEnd || (r.mHasUntil && candidate.time > r.mUntil && candidate.time != r.mStart)) {
+                break;
+            }
+            if (candidate.time < mStart || r.isExcluded(candidate)) {
+                continue;
+            }
+            time = candidate.time;
+            return true;
+        }
+        const qint64 periodStart = r.periodStart(mPeriod);
+        if (periodStart > mEnd || (r.mHasUntil && periodStart > r.mUntil && mPeriod) || mEmptyPeriods > maxEmptyPeriods) {
+            break;
+        }
+        if (!r.expandPeriod(mPeriod, mBuffer)) {
+            break;
+        }
+        mPeriod++;
+        mPos = 0;
+        mEmptyPeriods = mBuffer.empty() ? mEmptyPeriods + 1 : 0;
+    }
+    mRuleDone = true;
+    return false;
+}
+
+void RecurrenceIterator::fetch()
+{
+    if (!mHasRuleNext) {
+        mHasRuleNext = nextRuleOccurrence(mRuleNext);
+    }
+    const std::vector<Recurrence::Candidate> &rdates = mRecurrence.mRDates;
+    while (mRDatePos < rdates.size() && (rdates[mRDatePos].time < mStart || mRecurrence.isExcluded(rdates[mRDatePos]))) {
+        mRDatePos++;
+    }
+    const bool hasRDate = mRDatePos < rdates.size() && rdates[mRDatePos].time <= mEnd;
+    if (mHasRuleNext && (!hasRDate || mRuleNext <= rdates[mRDatePos].time)) {
+        mNext = mRuleNext;
+        mHasRuleNext = false;
+        //An rdate matching an occurrence of the rule is only returned once
+        if (hasRDate && rdates[mRDatePos].time == mNext) {
+            mRDatePos++;
+        }
+        mHasNext = true;
+    } else if (hasRDate) {
+        mNext = rdates[mRDatePos++].time;
+        mHasNext = true;
+    } else {
+        mHasNext = false;
+    }
+}
+
+bool RecurrenceIterator::hasNext() const
+{
+    return mHasNext;
+}
+
+qint64 RecurrenceIterator::next()
+{
+    Q_ASSERT(mHasNext);
+    const qint64 time = mNext;
+    fetch();
+    return time;
+}
+
+    }
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KOLABRECURRENCE_H
+#define KOLABRECURRENCE_H
+
+#include <kolabevent.h>
+#include <kdatetime.h>
+#include <QtGlobal>
+#include <vector>
+
+namespace Kolab {
+    namespace Calendaring {
+
+/**
+ * Returns the seconds since epoch of a date-time value, converted to UTC.
+ *
+ * Date-only and invalid values are not supported.
+ */
+qint64 toUtcSeconds(const Kolab::cDateTime &);
+qint64 toUtcSeconds(const KDateTime &);
+
+/**
+ * Returns a UTC date-time for the seconds since epoch.
+ */
+Kolab::cDateTime fromUtcSeconds(qint64);
+
+/**
+ * Returns the first and last second covered by a valid value, in seconds since epoch.
+ *
+ * Date-only values cover the whole day. Like for KDateTime comparisons,
+ * date-only and floating values are interpreted in the local timezone.
+ */
+qint64 toStartSeconds(const Kolab::cDateTime &);
+qint64 toEndSeconds(const Kolab::cDateTime &);
+
+/**
+ * Returns the time span of the event (both inclusive), for overlap checks.
+ *
+ * Events without end end at the start, or after the duration if there is one (like KCalCore::Event::dtEnd()).
+ * Recurrences are not taken into account.
+ *
+ * Returns false if the start is invalid.
+ */
+bool getTimeSpan(const Kolab::Event &, qint64 &start, qint64 &end);
+
+/**
+ * Recurrence expansion working directly on a Kolab::Event.
+ *
+ * This avoids the conversion to KCalCore for the common cases, all times are UTC seconds since epoch.
+ * Only a subset of the possible events is supported, if isSupported() returns false,
+ * the caller has to fall back to KCalCore::Recurrence.
+ *
+ * Supported are events with a date-time start and end (or no end and no duration), including rdates and exdates,
+ * that are either not recurring or recur daily, weekly, monthly or yearly with a count or a date-time until.
+ * Of the BY* rules BYDAY, BYMONTHDAY and BYMONTH are supported (positional BYDAY only within a month),
+ * the start date has to match the rule.
+ * The recurrence is expanded in the timezone of the start date, like KCalCore does.
+ */
+class Recurrence
+{
+public:
+    explicit Recurrence(const Kolab::Event &);
+
+    bool isSupported() const;
+    bool recurs() const;
+
+    /**
+     * The start and end of the first occurrence.
+     */
+    qint64 start() const;
+    qint64 end() const;
+
+    /**
+     * Returns the start times of all occurrences within the interval (inclusive), in ascending order.
+     *
+     * The result vector is cleared first, so it can be reused for multiple calls.
+     */
+    void timesInInterval(qint64 start, qint64 end, std::vector<qint64> &result) const;
+
+    /**
+     * Returns the start time of the first occurrence after @param time in @param next.
+     *
+     * Returns false if there is no further occurrence.
+     */
+    bool nextOccurrence(qint64 time, qint64 &next) const;
+
+    /**
+     * Returns the occurrence as date-time in the timezone of the start date.
+     */
+    Kolab::cDateTime toDateTime(qint64) const;
+
+private:
+    friend class RecurrenceIterator;
+
+    struct Candidate {
+        qint64 time;
+        //The day in the timezone of the start date
+        qint64 day;
+
+        bool operator<(const Candidate &other) const
+        {
+            return time < other.time;
+        }
+    };
+
+    bool expandPeriod(int period, std::vector<Candidate> &) const;
+    void addMonthDays(int year, int month, std::vector<qint64> &days) const;
+    bool matchesDay(qint64 day) const;
+    int firstPeriod(qint64 time) const;
+    qint64 periodStart(int period) const;
+    qint64 toTime(qint64 day) const;
+    qint64 toDay(qint64 time) const;
+    bool isExcluded(const Candidate &) const;
+
+    bool mSupported;
+    bool mRecurs;
+    bool mUtc;
+    qint64 mStart;
+    qint64 mEnd;
+    Kolab::RecurrenceRule::Frequency mFrequency;
+    int mInterval;
+    int mCount;
+    bool mHasUntil;
+    qint64 mUntil;
+    int mWeekStart;
+    //Pairs of position and day of week
+    std::vector< std::pair<int, int> > mByDay;
+    std::vector<int> mByMonthDay;
+    std::vector<int> mByMonth;
+    qint64 mStartDay;
+    qint64 mStartWeek;
+    int mStartYear;
+    int mStartMonth;
+    int mStartDayOfMonth;
+    int mStartDayOfWeek;
+    qint64 mTimeOfDay;
+    QTime mLocalTime;
+    KDateTime::Spec mSpec;
+    std::vector<Candidate> mRDates;
+    std::vector<qint64> mExTimes;
+    std::vector<qint64> mExDays;
+};
+
+/**
+ * Iterates over the start times of the occurrences within a window (inclusive), in ascending order.
+ *
+ * Unless the recurrence is limited by a count, the iteration starts directly in the period of the window start
+ * instead of iterating from the start date, so long windows far from the start of the event are cheap.
+ * To get all occurrences overlapping with the window, the start of the window has to be moved back by the duration.
+ *
+ * The recurrence must outlive the iterator, unsupported recurrences yield no occurrences.
+ */
+class RecurrenceIterator
+{
+public:
+    RecurrenceIterator(const Recurrence &, qint64 start, qint64 end);
+
+    bool hasNext() const;
+    qint64 next();
+
+private:
+    void fetch();
+    bool nextRuleOccurrence(qint64 &time);
+
+    const Recurrence &mRecurrence;
+    qint64 mStart;
+    qint64 mEnd;
+    int mPeriod;
+    int mCount;
+    int mEmptyPeriods;
+    std::vector<Recurrence::Candidate> mBuffer;
+    std::size_t mPos;
+    bool mRuleDone;
+    bool mHasRuleNext;
+    qint64 mRuleNext;
+    std::size_t mRDatePos;
+    bool mHasNext;
+    qint64 mNext;
+};
+
+    }
+}
+
+#endif
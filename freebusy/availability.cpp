@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "availability.h"
+#include "calendaring/recurrence.h"
+#include "kolabformat/errorhandler.h"
+
+namespace Kolab {
+    namespace FreebusyUtils {
+
+static const int bitsPerWord = 64;
+static const quint64 allBusy = ~Q_UINT64_C(0);
+
+//@cond PRIVATE
+class AvailabilityMap::Private
+{
+public:
+    Private()
+    :   start(0),
+        end(0),
+        granularity(0),
+        slotCount(0)
+    {
+    }
+
+    bool isBusy(int slot) const
+    {
+        return bits[slot / bitsPerWord] & (Q_UINT64_C(1) << (slot % bitsPerWord));
+    }
+
+    void setBusy(int first, int last);
+    bool isCompatible(const Private &other) const
+    {
+        return start == other.start && end == other.end && granularity == other.granularity;
+    }
+
+    qint64 start;
+    qint64 end;
+    int granularity;
+    int slotCount;
+    std::vector<quint64> bits;
+};
+//@endcond
+
+void AvailabilityMap::Private::setBusy(int first, int last)
+{
+    const int firstWord = first / bitsPerWord;
+    const int lastWord = last / bitsPerWord;
+    const quint64 firstMask = allBusy << (first % bitsPerWord);
+    const quint64 lastMask = allBusy >> (bitsPerWord - 1 - last % bitsPerWord);
+    if (firstWord == lastWord) {
+        bits[firstWord] |= firstMask & lastMask;
+        return;
+    }
+    bits[firstWord] |= firstMask;
+    for (int i = firstWord + 1; i < lastWord; i++) {
+        bits[i] = allBusy;
+    }
+    bits[lastWord] |= lastMask;
+}
+
+static bool isDateTime(const Kolab::cDateTime &dt)
+{
+    return dt.isValid() && !dt.isDateOnly();
+}
+
+AvailabilityMap::AvailabilityMap(const Kolab::cDateTime &start, const Kolab::cDateTime &end, int granularity)
+:   d(new AvailabilityMap::Private)
+{
+    if (!isDateTime(start) || !isDateTime(end) || granularity <= 0) {
+        Error() << "invalid window or granularity";
+        return;
+    }
+    d->start = Calendaring::toUtcSeconds(start);
+    d->end = Calendaring::toUtcSeconds(end);
+    if (d->end <= d->start) {
+        Error() << "the end of the window must be after the start";
+        return;
+    }
+    d->granularity = granularity;
+    d->slotCount = (d->end - d->start + granularity - 1) / granularity;
+    d->bits.resize((d->slotCount + bitsPerWord - 1) / bitsPerWord, 0);
+}
+
+AvailabilityMap::~AvailabilityMap()
+{
+    delete d;
+}
+
+bool AvailabilityMap::isValid() const
+{
+    return d->slotCount > 0;
+}
+
+void AvailabilityMap::addBusyPeriod(const Kolab::Period &period)
+{
+    if (!isValid()) {
+        return;
+    }
+    if (!isDateTime(period.start) || !isDateTime(period.end)) {
+        Warning() << "invalid period, skipping";
+        return;
+    }
+    const qint64 start = qMax(Calendaring::toUtcSeconds(period.start), d->start);
+    const qint64 end = qMin(Calendaring::toUtcSeconds(period.end), d->end);
+    if (end <= start) {
+        return;
+    }
+    const int first = (start - d->start) / d->granularity;
+    const int last = (end - d->start + d->granularity - 1) / d->granularity - 1;
+    d->setBusy(first, last);
+}
+
+void AvailabilityMap::addFreebusy(const Kolab::Freebusy &freebusy)
+{
+    Q_FOREACH (const Kolab::FreebusyPeriod &fbPeriod, freebusy.periods()) {
+        Q_FOREACH (const Kolab::Period &period, fbPeriod.periods()) {
+            addBusyPeriod(period);
+        }
+    }
+}
+
+bool AvailabilityMap::unite(const AvailabilityMap &other)
+{
+    if (!d->isCompatible(*other.d)) {
+        Error() << "the maps are not compatible";
+        return false;
+    }
+    //Plain loops over whole words, so the compiler can vectorize them
+    std::vector<quint64> &bits = d->bits;
+    const std::vector<quint64> &otherBits = other.d->bits;
+    for (std::size_t i = 0; i < bits.size(); i++) {
+        bits[i] |= otherBits[i];
+    }
+    return true;
+}
+
+bool AvailabilityMap::intersect(const AvailabilityMap &other)
+{
+    if (!d->isCompatible(*other.d)) {
+        Error() << "the maps are not compatible";
+        return false;
+    }
+    std::vector<quint64> &bits = d->bits;
+    const std::vector<quint64> &otherBits = other.d->bits;
+    for (std::size_t i = 0; i < bits.size(); i++) {
+        bits[i] &= otherBits[i];
+    }
+    return true;
+}
+
+std::vector<Kolab::Period> AvailabilityMap::findFreeWindows(int duration) const
+{
+    std::vector<Kolab::Period> windows;
+    int slot = 0;
+    while (slot < d->slotCount) {
+        //Skip whole words of busy slots
+        if (slot % bitsPerWord == 0 && d->bits[slot / bitsPerWord] == allBusy) {
+            slot += bitsPerWord;
+            continue;
+        }
+        if (d->isBusy(slot)) {
+            slot++;
+            continue;
+        }
+        const int first = slot;
+        while (slot < d->slotCount) {
+            //Skip whole words of free slots (the unused bits of the last word are never set)
+            if (slot % bitsPerWord == 0 && d->bits[slot / bitsPerWord] == 0) {
+                slot += bitsPerWord;
+                continue;
+            }
+            if (d->isBusy(slot)) {
+                break;
+            }
+            slot++;
+        }
+        slot = qMin(slot, d->slotCount);
+        const qint64 start = d->start + static_cast<qint64>(first) * d->granularity;
+        const qint64 end = qMin(d->start + static_cast<qint64>(slot) * d->granularity, d->end);
+        if (end - start >= duration) {
+            windows.push_back(Kolab::Period(Calendaring::fromUtcSeconds(start), Calendaring::fromUtcSeconds(end)));
+        }
+    }
+    return windows;
+}
+
+std::vector<Kolab::Period> findFreeWindows(const std::vector<Kolab::Freebusy> &fbList, const Kolab::cDateTime &start, const Kolab::cDateTime &end, int duration, int granularity)
+{
+    AvailabilityMap map(start, end, granularity);
+    if (!map.isValid()) {
+        return std::vector<Kolab::Period>();
+    }
+    Q_FOREACH (const Kolab::Freebusy &fb, fbList) {
+        map.addFreebusy(fb);
+    }
+    return map.findFreeWindows(duration);
+}
+
+    }
+}
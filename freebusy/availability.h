@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef KOLABAVAILABILITY_H
+#define KOLABAVAILABILITY_H
+
+#include "kolab_export.h"
+#include <kolabfreebusy.h>
+
+namespace Kolab {
+    namespace FreebusyUtils {
+
+/**
+ * Availability within a time window, split into slots of a fixed granularity.
+ *
+ * A slot is busy as soon as any busy period overlaps with it, so free slots are guaranteed to be free.
+ * The maps of multiple attendees can be combined with unite() (busy if anyone is busy)
+ * and intersect() (busy only if everyone is busy), which operate on whole words of the underlying bitset.
+ *
+ * The freebusy lists can be stored objects, or created from events using generateFreeBusy().
+ */
+class KOLAB_EXPORT AvailabilityMap {
+public:
+    /**
+     * @param granularity the length of a slot in seconds
+     */
+    AvailabilityMap(const Kolab::cDateTime &start, const Kolab::cDateTime &end, int granularity = 15 * 60);
+    ~AvailabilityMap();
+
+    /**
+     * Returns false if the window or granularity is invalid.
+     */
+    bool isValid() const;
+
+    /**
+     * Marks the slots overlapping with the period as busy.
+     *
+     * Periods outside of the window are ignored.
+     */
+    void addBusyPeriod(const Kolab::Period &);
+
+    /**
+     * Marks all periods of the freebusy list as busy, regardless of the busy type.
+     */
+    void addFreebusy(const Kolab::Freebusy &);
+
+    /**
+     * Combine with the map of another attendee.
+     *
+     * Both maps must have the same window and granularity, false is returned otherwise.
+     */
+    bool unite(const AvailabilityMap &);
+    bool intersect(const AvailabilityMap &);
+
+    /**
+     * Returns all maximal free windows that are at least @param duration seconds long, in ascending order.
+     */
+    std::vector<Kolab::Period> findFreeWindows(int duration) const;
+
+private:
+    //@cond PRIVATE
+    AvailabilityMap(const AvailabilityMap &other);
+    AvailabilityMap &operator=(const AvailabilityMap &rhs);
+    class Private;
+    Private *const d;
+    //@endcond
+};
+
+/**
+ * Returns the windows of at least @param duration seconds in which all freebusy lists are free.
+ *
+ * See AvailabilityMap.
+ */
+KOLAB_EXPORT std::vector<Kolab::Period> findFreeWindows(const std::vector<Kolab::Freebusy> &, const Kolab::cDateTime &start, const Kolab::cDateTime &end, int duration, int granularity = 15 * 60);
+
+    }
+}
+
+#endif // KOLABAVAILABILITY_H
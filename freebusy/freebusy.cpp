@@ -19,11 +19,17 @@
 #include "freebusy.h"
 #include "conversion/kcalconversion.h"
 #include "conversion/commonconversion.h"
+#include "calendaring/recurrence.h"
+#include "kolabformat/errorhandler.h"
 #include "libkolab-version.h"
-#include <kcalcore/freebusy.h>
-#include <kcalcore/icalformat.h>
 #include <kdebug.h>
 #include <quuid.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <QSet>
+#include <QHash>
+#include <QtConcurrentMap>
 
 
 // namespace KCalCore {
@@ -145,7 +151,7 @@ Kolab::Period addLocalPeriod(  const KDateTime &eventStart, const KDateTime &eve
             ( eventStart <= mDtEnd ) ) ||
           ( ( mDtStart <= eventEnd ) &&
             ( eventEnd <= mDtEnd ) ) ) ) {
-    qDebug() << "event is not within the fb range, skipping";
+    Debug() << "event is not within the fb range, skipping";
     return Kolab::Period();
   }
 
@@ -172,17 +178,582 @@ Kolab::Period addLocalPeriod(  const KDateTime &eventStart, const KDateTime &eve
   return Kolab::Period(Kolab::Conversion::fromDate(tmpStart), Kolab::Conversion::fromDate(tmpEnd));
 }
 
-Freebusy generateFreeBusy(const std::vector< Event >& events, const cDateTime& startDate, const cDateTime& endDate)
+/*
+ * Key to match the occurrences of a master with the recurrence-id of an exception.
+ */
+static qint64 recurrenceKey(const KDateTime &dt)
+{
+    if (dt.isDateOnly()) {
+        return QDate(1970, 1, 1).daysTo(dt.date()) * 86400;
+    }
+    return Calendaring::toUtcSeconds(dt);
+}
+
+static qint64 recurrenceKey(const Kolab::cDateTime &dt)
+{
+    if (dt.isDateOnly()) {
+        return QDate(1970, 1, 1).daysTo(QDate(dt.year(), dt.month(), dt.day())) * 86400;
+    }
+    return Calendaring::toUtcSeconds(dt);
+}
+
+/*
+ * The occurrences matching one of the recurrence-ids are skipped, they are replaced by the exceptions.
+ */
+static std::vector<Kolab::Period> getPeriods(const KCalCore::Event::Ptr &event, const KDateTime &start, const KDateTime &end, const QSet<qint64> &recurrenceIds)
+{
+    const KDateTime eventStart = event->dtStart().toUtc();
+    const KDateTime eventEnd = event->dtEnd().toUtc();
+
+    std::vector <Kolab::Period> periods;
+    if ( event->recurs() ) {
+        const KCalCore::Duration duration( eventStart, eventEnd );
+        //Occurrences starting before the window can still overlap with it
+        const KCalCore::DateTimeList list = event->recurrence()->timesInInterval(start.addSecs(-duration.asSeconds()), end);
+        Q_FOREACH (const KDateTime &dt, list) {
+            if (!recurrenceIds.isEmpty() && recurrenceIds.contains(recurrenceKey(dt))) {
+                continue;
+            }
+            const KDateTime utc = dt.toUtc();
+            const Kolab::Period &period = addLocalPeriod(utc, duration.end(utc), start, end);
+            if (period.isValid()) {
+                periods.push_back(period);
+            }
+        }
+    } else {
+        const Kolab::Period &period = addLocalPeriod(eventStart, eventEnd, start, end);
+        if (period.isValid()) {
+            periods.push_back(period);
+        }
+    }
+    return periods;
+}
+
+/*
+ * Same as addLocalPeriod, but on UTC seconds.
+ */
+static void addPeriod(qint64 eventStart, qint64 eventEnd, qint64 start, qint64 end, std::vector<Kolab::Period> &periods)
+{
+    if (!((start <= eventStart && eventStart <= end) || (start <= eventEnd && eventEnd <= end))) {
+        return;
+    }
+    periods.push_back(Kolab::Period(Calendaring::fromUtcSeconds(qMax(eventStart, start)), Calendaring::fromUtcSeconds(qMin(eventEnd, end))));
+}
+
+/*
+ * Returns the periods of a single event within the window (the window has to be UTC).
+ *
+ * Only the occurrences overlapping with the window are expanded.
+ */
+static std::vector<Kolab::Period> getPeriods(const Kolab::Event &event, const KDateTime &start, const KDateTime &end, const QSet<qint64> &recurrenceIds)
+{
+    std::vector<Kolab::Period> periods;
+    const Calendaring::Recurrence recurrence(event);
+    if (!recurrence.isSupported()) {
+        return getPeriods(Kolab::Conversion::toKCalCore(event), start, end, recurrenceIds);
+    }
+    const qint64 startSeconds = Calendaring::toUtcSeconds(start);
+    const qint64 endSeconds = Calendaring::toUtcSeconds(end);
+    const qint64 duration = recurrence.end() - recurrence.start();
+    Calendaring::RecurrenceIterator it(recurrence, startSeconds - duration, endSeconds);
+    while (it.hasNext()) {
+        const qint64 occurrence = it.next();
+        if (!recurrenceIds.isEmpty() && recurrenceIds.contains(occurrence)) {
+            continue;
+        }
+        addPeriod(occurrence, occurrence + duration, startSeconds, endSeconds, periods);
+    }
+    return periods;
+}
+
+/*
+ * Transparent events don't block any time, with @param busyTypes cancelled events don't either.
+ */
+static bool isBusy(const Kolab::Event &event, bool busyTypes)
+{
+    return !event.transparency() && (!busyTypes || event.status() != Kolab::StatusCancelled);
+}
+
+static bool isBusy(const KCalCore::Event::Ptr &event, bool busyTypes)
+{
+    return event->transparency() != KCalCore::Event::Transparent && (!busyTypes || event->status() != KCalCore::Incidence::StatusCanceled);
+}
+
+/*
+ * Creates a Busy period, or a Tentative period for tentative events with @param busyTypes.
+ */
+static Kolab::FreebusyPeriod createFreebusyPeriod(const std::vector<Kolab::Period> &periods, bool tentative, bool busyTypes, const std::string &uid, const std::string &summary, const std::string &location)
+{
+    Kolab::FreebusyPeriod period;
+    period.setPeriods(periods);
+    //TODO out-of-office, the events don't have a property for it
+    period.setType(busyTypes && tentative ? Kolab::FreebusyPeriod::Tentative : Kolab::FreebusyPeriod::Busy);
+    period.setEvent(uid, summary, location);
+    return period;
+}
+
+/*
+ * Appends the periods of a master event, with the occurrences replaced by the exceptions.
+ *
+ * The exceptions are only appended if includeExceptions is true, the master may be 0 if only the exceptions are available.
+ */
+static void addEventPeriods(const Kolab::Event *master, const std::vector<const Kolab::Event*> &exceptions, bool includeExceptions, bool busyTypes,
+                            const KDateTime &start, const KDateTime &end, std::vector<Kolab::FreebusyPeriod> &freebusyPeriods)
+{
+    // If this event is transparent it shouldn't be in the freebusy list.
+    if (master && isBusy(*master, busyTypes)) {
+        QSet<qint64> recurrenceIds;
+        Q_FOREACH (const Kolab::Event *exception, exceptions) {
+            recurrenceIds.insert(recurrenceKey(exception->recurrenceID()));
+        }
+        const std::vector<Kolab::Period> periods = getPeriods(*master, start, end, recurrenceIds);
+        if (!periods.empty()) {
+            freebusyPeriods.push_back(createFreebusyPeriod(periods, master->status() == Kolab::StatusTentative, busyTypes, master->uid(), master->summary(), master->location()));
+        }
+    }
+    if (!includeExceptions) {
+        return;
+    }
+    Q_FOREACH (const Kolab::Event *exception, exceptions) {
+        if (!isBusy(*exception, busyTypes)) {
+            continue;
+        }
+        //The exception only replaces a single occurrence
+        //TODO apply thisandfuture exceptions to all following occurrences
+        std::vector<Kolab::Period> periods;
+        if (exception->recurrenceRule().isValid() || !exception->recurrenceDates().empty()) {
+            Kolab::Event instance(*exception);
+            instance.setRecurrenceRule(Kolab::RecurrenceRule());
+            instance.setRecurrenceDates(std::vector<Kolab::cDateTime>());
+            periods = getPeriods(instance, start, end, QSet<qint64>());
+        } else {
+            periods = getPeriods(*exception, start, end, QSet<qint64>());
+        }
+        if (!periods.empty()) {
+            freebusyPeriods.push_back(createFreebusyPeriod(periods, exception->status() == Kolab::StatusTentative, busyTypes, exception->uid(), exception->summary(), exception->location()));
+        }
+    }
+}
+
+typedef std::pair<qint64, qint64> Interval;
+
+/*
+ * Sorts the intervals and merges overlapping and adjacent ones in a single sweep.
+ */
+static void mergeIntervals(std::vector<Interval> &intervals)
 {
-    QList<KCalCore::Event::Ptr> list;
-    foreach (const Kolab::Event &e, events) {
-        list.append(Kolab::Conversion::toKCalCore(e));
+    if (intervals.empty()) {
+        return;
+    }
+    std::sort(intervals.begin(), intervals.end());
+    std::vector<Interval>::iterator current = intervals.begin();
+    for (std::vector<Interval>::const_iterator it = intervals.begin() + 1; it != intervals.end(); ++it) {
+        if (it->first <= current->second) {
+            current->second = qMax(current->second, it->second);
+        } else {
+            *(++current) = *it;
+        }
     }
+    intervals.erase(current + 1, intervals.end());
+}
+
+//@cond PRIVATE
+/*
+ * Collects the periods by busy type, and merges them into a single sorted FreebusyPeriod per type.
+ */
+class FreebusyMerger
+{
+public:
+    void add(const Kolab::FreebusyPeriod &period)
+    {
+        std::size_t index = 0;
+        while (index < mTypes.size() && mTypes.at(index).type() != period.type()) {
+            index++;
+        }
+        if (index == mTypes.size()) {
+            Kolab::FreebusyPeriod typePeriod;
+            typePeriod.setType(period.type());
+            mTypes.push_back(typePeriod);
+            mIntervals.push_back(std::vector<Interval>());
+        }
+        std::vector<Interval> &intervals = mIntervals[index];
+        Q_FOREACH (const Kolab::Period &p, period.periods()) {
+            if (!p.start.isValid() || p.start.isDateOnly() || !p.end.isValid() || p.end.isDateOnly()) {
+                Warning() << "invalid period, skipping";
+                continue;
+            }
+            intervals.push_back(Interval(Calendaring::toUtcSeconds(p.start), Calendaring::toUtcSeconds(p.end)));
+        }
+    }
+
+    /*
+     * Appends one FreebusyPeriod per busy type, in the order the types were first added.
+     */
+    void appendTo(std::vector<Kolab::FreebusyPeriod> &periods)
+    {
+        for (std::size_t i = 0; i < mTypes.size(); i++) {
+            std::vector<Interval> &intervals = mIntervals[i];
+            if (intervals.empty()) {
+                continue;
+            }
+            mergeIntervals(intervals);
+            std::vector<Kolab::Period> list;
+            list.reserve(intervals.size());
+            Q_FOREACH (const Interval &interval, intervals) {
+                list.push_back(Kolab::Period(Calendaring::fromUtcSeconds(interval.first), Calendaring::fromUtcSeconds(interval.second)));
+            }
+            Kolab::FreebusyPeriod &typePeriod = mTypes[i];
+            typePeriod.setPeriods(list);
+            periods.push_back(typePeriod);
+        }
+    }
+
+private:
+    std::vector<Kolab::FreebusyPeriod> mTypes;
+    std::vector< std::vector<Interval> > mIntervals;
+};
+//@endcond
+
+static void compactPeriods(std::vector<Kolab::FreebusyPeriod> &periods, bool simple, bool merge)
+{
+    if (merge) {
+        FreebusyMerger merger;
+        Q_FOREACH (const Kolab::FreebusyPeriod &period, periods) {
+            merger.add(period);
+        }
+        periods.clear();
+        merger.appendTo(periods);
+    } else if (simple) {
+        for (std::size_t i = 0; i < periods.size(); i++) {
+            periods[i].setEvent(std::string(), std::string(), std::string());
+        }
+    }
+}
+
+static Freebusy generateKCalCoreFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDateTime& startDate, const KDateTime& endDate, const KCalCore::Person::Ptr &organizer, bool busyTypes);
+
+Freebusy generateFreeBusy(const std::vector< Event >& events, const cDateTime& startDate, const cDateTime& endDate)
+{
+    return generateFreeBusy(events, startDate, endDate, false, false);
+}
+
+Freebusy generateFreeBusy(const std::vector< Event >& events, const cDateTime& startDate, const cDateTime& endDate, bool simple, bool merge)
+{
     KCalCore::Person::Ptr person(new KCalCore::Person("dummyname", "dummyemail"));
-    return generateFreeBusy(list, Kolab::Conversion::toDate(startDate), Kolab::Conversion::toDate(endDate), person);
+    if (!startDate.isValid() || startDate.isDateOnly() || !endDate.isValid() || endDate.isDateOnly()) {
+        QList<KCalCore::Event::Ptr> list;
+        foreach (const Kolab::Event &e, events) {
+            list.append(Kolab::Conversion::toKCalCore(e));
+        }
+        Kolab::Freebusy freebusy = generateKCalCoreFreeBusy(list, Kolab::Conversion::toDate(startDate), Kolab::Conversion::toDate(endDate), person, merge);
+        if (simple || merge) {
+            std::vector<Kolab::FreebusyPeriod> periods = freebusy.periods();
+            compactPeriods(periods, simple, merge);
+            freebusy.setPeriods(periods);
+        }
+        return freebusy;
+    }
+
+    /*
+     * The events are expanded natively whenever possible, only events which are not supported by Calendaring::Recurrence
+     * are converted to KCalCore. The result is the same as for the KCalCore based implementation.
+     */
+    const KDateTime start = Kolab::Conversion::toDate(startDate).toUtc();
+    const KDateTime end = Kolab::Conversion::toDate(endDate).toUtc();
+
+    //The exceptions are grouped by uid, so they can be applied while expanding the master
+    std::map<std::string, std::vector<const Kolab::Event*> > exceptions;
+    std::set<std::string> masters;
+    Q_FOREACH (const Kolab::Event &event, events) {
+        if (event.recurrenceID().isValid()) {
+            exceptions[event.uid()].push_back(&event);
+        } else {
+            masters.insert(event.uid());
+        }
+    }
+
+    std::vector<Kolab::FreebusyPeriod> freebusyPeriods;
+    const std::vector<const Kolab::Event*> noExceptions;
+    Q_FOREACH (const Kolab::Event &event, events) {
+        if (event.recurrenceID().isValid()) {
+            //Exceptions without master in the list are added as they are
+            if (!masters.count(event.uid())) {
+                addEventPeriods(0, std::vector<const Kolab::Event*>(1, &event), true, merge, start, end, freebusyPeriods);
+            }
+            continue;
+        }
+        std::map<std::string, std::vector<const Kolab::Event*> >::iterator it = exceptions.find(event.uid());
+        if (it == exceptions.end()) {
+            addEventPeriods(&event, noExceptions, false, merge, start, end, freebusyPeriods);
+            continue;
+        }
+        addEventPeriods(&event, it->second, true, merge, start, end, freebusyPeriods);
+        exceptions.erase(it);
+    }
+    compactPeriods(freebusyPeriods, simple, merge);
+
+    Kolab::Freebusy freebusy;
+
+    freebusy.setStart(Kolab::Conversion::fromDate(start));
+    freebusy.setEnd(Kolab::Conversion::fromDate(end));
+    freebusy.setPeriods(freebusyPeriods);
+    freebusy.setUid(createUuid().toStdString());
+    freebusy.setTimestamp(Kolab::Conversion::fromDate(KDateTime::currentUtcDateTime()));
+    freebusy.setOrganizer(ContactReference(Kolab::ContactReference::EmailReference, Kolab::Conversion::toStdString(person->email()), Kolab::Conversion::toStdString(person->name())));
+    return freebusy;
+}
+
+//@cond PRIVATE
+struct FreebusyCacheEntry
+{
+    FreebusyCacheEntry()
+    :   hasMaster(false)
+    {
+    }
+
+    bool hasMaster;
+    Kolab::Event master;
+    std::vector<Kolab::Event> exceptions;
+    std::vector<Kolab::FreebusyPeriod> periods;
+};
+
+class FreebusyCache::Private
+{
+public:
+    void update(FreebusyCacheEntry &entry)
+    {
+        std::vector<const Kolab::Event*> exceptions;
+        exceptions.reserve(entry.exceptions.size());
+        Q_FOREACH (const Kolab::Event &exception, entry.exceptions) {
+            exceptions.push_back(&exception);
+        }
+        entry.periods.clear();
+        addEventPeriods(entry.hasMaster ? &entry.master : 0, exceptions, true, false, start, end, entry.periods);
+    }
+
+    KDateTime start;
+    KDateTime end;
+    Kolab::ContactReference organizer;
+    std::map<std::string, FreebusyCacheEntry> entries;
+};
+//@endcond
+
+FreebusyCache::FreebusyCache(const cDateTime &startDate, const cDateTime &endDate)
+:   d(new FreebusyCache::Private)
+{
+    if (!startDate.isValid() || startDate.isDateOnly() || !endDate.isValid() || endDate.isDateOnly()) {
+        Error() << "the window must be date-time values";
+        return;
+    }
+    d->start = Kolab::Conversion::toDate(startDate).toUtc();
+    d->end = Kolab::Conversion::toDate(endDate).toUtc();
+}
+
+FreebusyCache::~FreebusyCache()
+{
+    delete d;
+}
+
+void FreebusyCache::addEvent(const Kolab::Event &event)
+{
+    if (!d->start.isValid()) {
+        return;
+    }
+    //Only the master and exceptions with the same uid have to be expanded again
+    FreebusyCacheEntry &entry = d->entries[event.uid()];
+    if (event.recurrenceID().isValid()) {
+        const qint64 key = recurrenceKey(event.recurrenceID());
+        std::vector<Kolab::Event>::iterator it = entry.exceptions.begin();
+        while (it != entry.exceptions.end() && recurrenceKey(it->recurrenceID()) != key) {
+            ++it;
+        }
+        if (it != entry.exceptions.end()) {
+            *it = event;
+        } else {
+            entry.exceptions.push_back(event);
+        }
+    } else {
+        entry.master = event;
+        entry.hasMaster = true;
+    }
+    d->update(entry);
+}
+
+void FreebusyCache::removeEvent(const std::string &uid)
+{
+    d->entries.erase(uid);
+}
+
+void FreebusyCache::removeEvent(const std::string &uid, const cDateTime &recurrenceId)
+{
+    std::map<std::string, FreebusyCacheEntry>::iterator entryIt = d->entries.find(uid);
+    if (entryIt == d->entries.end()) {
+        return;
+    }
+    FreebusyCacheEntry &entry = entryIt->second;
+    if (recurrenceId.isValid()) {
+        const qint64 key = recurrenceKey(recurrenceId);
+        std::vector<Kolab::Event>::iterator it = entry.exceptions.begin();
+        while (it != entry.exceptions.end() && recurrenceKey(it->recurrenceID()) != key) {
+            ++it;
+        }
+        if (it == entry.exceptions.end()) {
+            return;
+        }
+        entry.exceptions.erase(it);
+    } else {
+        entry.master = Kolab::Event();
+        entry.hasMaster = false;
+    }
+    if (!entry.hasMaster && entry.exceptions.empty()) {
+        d->entries.erase(entryIt);
+        return;
+    }
+    d->update(entry);
+}
+
+void FreebusyCache::clear()
+{
+    d->entries.clear();
+}
+
+void FreebusyCache::setOrganizer(const ContactReference &organizer)
+{
+    d->organizer = organizer;
+}
+
+Freebusy FreebusyCache::freebusy() const
+{
+    std::vector<Kolab::FreebusyPeriod> freebusyPeriods;
+    freebusyPeriods.reserve(d->entries.size());
+    for (std::map<std::string, FreebusyCacheEntry>::const_iterator it = d->entries.begin(); it != d->entries.end(); ++it) {
+        freebusyPeriods.insert(freebusyPeriods.end(), it->second.periods.begin(), it->second.periods.end());
+    }
+
+    Kolab::Freebusy freebusy;
+    freebusy.setStart(Kolab::Conversion::fromDate(d->start));
+    freebusy.setEnd(Kolab::Conversion::fromDate(d->end));
+    freebusy.setPeriods(freebusyPeriods);
+    freebusy.setUid(createUuid().toStdString());
+    freebusy.setTimestamp(Kolab::Conversion::fromDate(KDateTime::currentUtcDateTime()));
+    freebusy.setOrganizer(d->organizer);
+    return freebusy;
+}
+
+FreebusyResultHandler::~FreebusyResultHandler()
+{
+}
+
+//@cond PRIVATE
+struct FreebusyBatchItem
+{
+    int index;
+    const FreebusyRequest *request;
+    FreebusyResultHandler *handler;
+};
+
+static void generateBatchItem(FreebusyBatchItem &item)
+{
+    const FreebusyRequest &request = *item.request;
+    Kolab::Freebusy freebusy = generateFreeBusy(request.events, request.start, request.end);
+    freebusy.setOrganizer(ContactReference(Kolab::ContactReference::EmailReference, request.organizerEmail, request.organizerName));
+    //The error handler is thread local, so the errors of a job would otherwise accumulate in the pool thread
+    ErrorHandler::clearErrors();
+    item.handler->result(item.index, freebusy);
+}
+
+static bool isUtc(const Kolab::cDateTime &dt)
+{
+    return !dt.isValid() || (!dt.isDateOnly() && dt.isUTC());
+}
+
+static bool isUtc(const std::vector<Kolab::cDateTime> &list)
+{
+    Q_FOREACH (const Kolab::cDateTime &dt, list) {
+        if (!isUtc(dt)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Returns true if the request can be processed without KSystemTimeZones and KCalCore.
+ *
+ * KSystemTimeZones fills a process-global zone cache lazily, and KTimeZone is reference counted and caches
+ * lookups without any locking. So all timezone handling has to stay on a single thread.
+ * Date-only and floating values use the local timezone, so only UTC values and natively expanded events are safe.
+ */
+static bool isTimezoneIndependent(const FreebusyRequest &request)
+{
+    if (!request.start.isValid() || !isUtc(request.start) || !request.end.isValid() || !isUtc(request.end)) {
+        return false;
+    }
+    Q_FOREACH (const Kolab::Event &event, request.events) {
+        if (!event.start().isValid() || !isUtc(event.start()) || !isUtc(event.end()) || !isUtc(event.recurrenceID()) ||
+            !isUtc(event.recurrenceRule().end()) || !isUtc(event.recurrenceDates()) || !isUtc(event.exceptionDates())) {
+            return false;
+        }
+        if (!Calendaring::Recurrence(event).isSupported()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+class VectorResultHandler: public FreebusyResultHandler
+{
+public:
+    explicit VectorResultHandler(std::size_t size)
+    :   results(size)
+    {
+    }
+
+    virtual void result(int index, const Kolab::Freebusy &freebusy)
+    {
+        //Every index is written by exactly one job, so no locking is required
+        results[index] = freebusy;
+    }
+
+    std::vector<Kolab::Freebusy> results;
+};
+//@endcond
+
+void generateFreeBusy(const std::vector<FreebusyRequest> &requests, FreebusyResultHandler &handler)
+{
+    QVector<FreebusyBatchItem> items;
+    QVector<FreebusyBatchItem> timezoneItems;
+    for (std::size_t i = 0; i < requests.size(); i++) {
+        FreebusyBatchItem item;
+        item.index = i;
+        item.request = &requests.at(i);
+        item.handler = &handler;
+        if (isTimezoneIndependent(*item.request)) {
+            items.append(item);
+        } else {
+            timezoneItems.append(item);
+        }
+    }
+    QtConcurrent::blockingMap(items, generateBatchItem);
+    //The timezone handling is not thread-safe, so these requests are processed in the calling thread
+    for (int i = 0; i < timezoneItems.size(); i++) {
+        generateBatchItem(timezoneItems[i]);
+    }
+}
+
+std::vector<Freebusy> generateFreeBusy(const std::vector<FreebusyRequest> &requests)
+{
+    VectorResultHandler handler(requests.size());
+    generateFreeBusy(requests, handler);
+    return handler.results;
 }
 
 Freebusy generateFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDateTime& startDate, const KDateTime& endDate, const KCalCore::Person::Ptr &organizer)
+{
+    return generateKCalCoreFreeBusy(events, startDate, endDate, organizer, false);
+}
+
+static Freebusy generateKCalCoreFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDateTime& startDate, const KDateTime& endDate, const KCalCore::Person::Ptr &organizer, bool busyTypes)
 {
     /*
      * TODO the conversion of date-only values to date-time is only necessary because xCal doesn't allow date only. iCalendar doesn't seem to make this restriction so it looks like a bug.
@@ -197,46 +768,53 @@ Freebusy generateFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDate
         end.setTime(QTime(0,0,0,0)); //The window is inclusive
     }
 
+    //The exceptions are grouped by uid, so they can be applied while expanding the master
+    QHash<QString, KCalCore::Event::List> exceptions;
+    QSet<QString> masters;
+    Q_FOREACH (const KCalCore::Event::Ptr &event, events) {
+        if (event->hasRecurrenceId()) {
+            exceptions[event->uid()].append(event);
+        } else {
+            masters.insert(event->uid());
+        }
+    }
+
     //TODO try to merge that with KCalCore::Freebusy
     std::vector<Kolab::FreebusyPeriod> freebusyPeriods;
     Q_FOREACH (KCalCore::Event::Ptr event, events) {    
-        // If this event is transparent it shouldn't be in the freebusy list.
-        if ( event->transparency() == KCalCore::Event::Transparent ) {
-            continue;
-        }
-
+        KCalCore::Event::List instances;
         if ( event->hasRecurrenceId() ) {
-            continue; //TODO apply special period exception (duration could be different)
+            //Exceptions without master in the list are added as they are
+            if (masters.contains(event->uid())) {
+                continue;
+            }
+            instances << event;
+        } else {
+            instances = exceptions.take(event->uid());
+            // If this event is transparent it shouldn't be in the freebusy list.
+            if ( isBusy(event, busyTypes) ) {
+                QSet<qint64> recurrenceIds;
+                Q_FOREACH (const KCalCore::Event::Ptr &exception, instances) {
+                    recurrenceIds.insert(recurrenceKey(exception->recurrenceId()));
+                }
+                const std::vector <Kolab::Period> periods = getPeriods(event, start, end, recurrenceIds);
+                if (!periods.empty()) {
+                    freebusyPeriods.push_back(createFreebusyPeriod(periods, event->status() == KCalCore::Incidence::StatusTentative, busyTypes, Kolab::Conversion::toStdString(event->uid()), Kolab::Conversion::toStdString(event->summary()), Kolab::Conversion::toStdString(event->location())));
+                }
+            }
         }
 
-        const KDateTime eventStart = event->dtStart().toUtc();
-        const KDateTime eventEnd = event->dtEnd().toUtc();
-
-        std::vector <Kolab::Period> periods;
-        if ( event->recurs() ) {
-            const KCalCore::Duration duration( eventStart, eventEnd );
-            const KCalCore::DateTimeList list = event->recurrence()->timesInInterval(start, end);
-            Q_FOREACH (const KDateTime &dt, list) {
-                const KDateTime utc = dt.toUtc();
-                const Kolab::Period &period = addLocalPeriod(utc, duration.end(utc), start, end);
-                if (period.isValid()) {
-                    periods.push_back(period);
-                }
+        //The exception only replaces a single occurrence
+        //TODO apply thisandfuture exceptions to all following occurrences
+        Q_FOREACH (const KCalCore::Event::Ptr &exception, instances) {
+            if ( !isBusy(exception, busyTypes) ) {
+                continue;
             }
-        } else {
-            const Kolab::Period &period = addLocalPeriod(eventStart, eventEnd, start, end);
+            const Kolab::Period &period = addLocalPeriod(exception->dtStart().toUtc(), exception->dtEnd().toUtc(), start, end);
             if (period.isValid()) {
-                periods.push_back(period);
+                freebusyPeriods.push_back(createFreebusyPeriod(std::vector<Kolab::Period>(1, period), exception->status() == KCalCore::Incidence::StatusTentative, busyTypes, Kolab::Conversion::toStdString(exception->uid()), Kolab::Conversion::toStdString(exception->summary()), Kolab::Conversion::toStdString(exception->location())));
             }
         }
-        if (!periods.empty()) {
-            Kolab::FreebusyPeriod period;
-            period.setPeriods(periods);
-            //TODO get busy type from event (out-of-office, tentative)
-            period.setType(Kolab::FreebusyPeriod::Busy);
-            period.setEvent(Kolab::Conversion::toStdString(event->uid()), Kolab::Conversion::toStdString(event->summary()), Kolab::Conversion::toStdString(event->location()));
-            freebusyPeriods.push_back(period);
-        }
     }
 
     Kolab::Freebusy freebusy;
@@ -254,8 +832,14 @@ Freebusy generateFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDate
 }
 
 Freebusy aggregateFreeBusy(const std::vector< Freebusy >& fbList, const std::string &organizerEmail, const std::string &organizerName, bool simple)
+{
+    return aggregateFreeBusy(fbList, organizerEmail, organizerName, simple, false);
+}
+
+Freebusy aggregateFreeBusy(const std::vector< Freebusy >& fbList, const std::string &organizerEmail, const std::string &organizerName, bool simple, bool merge)
 {
     std::vector <Kolab::FreebusyPeriod > periods;
+    FreebusyMerger merger;
 
     KDateTime start;
     KDateTime end;
@@ -271,6 +855,10 @@ Freebusy aggregateFreeBusy(const std::vector< Freebusy >& fbList, const std::str
         }
 
         Q_FOREACH (const Kolab::FreebusyPeriod &period, fb.periods()) {
+            if (merge) {
+                merger.add(period);
+                continue;
+            }
             Kolab::FreebusyPeriod simplifiedPeriod;
             simplifiedPeriod.setPeriods(period.periods());
             simplifiedPeriod.setType(period.type());
@@ -280,6 +868,8 @@ Freebusy aggregateFreeBusy(const std::vector< Freebusy >& fbList, const std::str
             periods.push_back(simplifiedPeriod);
         }
     }
+
+    merger.appendTo(periods);
     
     Freebusy aggregateFB;
 
@@ -292,29 +882,197 @@ Freebusy aggregateFreeBusy(const std::vector< Freebusy >& fbList, const std::str
     return aggregateFB;
 }
 
-std::string toIFB(const Kolab::Freebusy &freebusy)
+IFBOutput::~IFBOutput()
+{
+}
+
+//@cond PRIVATE
+/*
+ * Buffers the output and folds the content lines according to RFC 5545.
+ */
+class IFBLineWriter
+{
+public:
+    explicit IFBLineWriter(IFBOutput &output)
+    :   mOutput(output)
+    {
+        mBuffer.reserve(bufferSize + 2 * maxLineLength);
+    }
+
+    ~IFBLineWriter()
+    {
+        flush();
+    }
+
+    void writeLine(const std::string &line)
+    {
+        std::size_t pos = 0;
+        std::size_t lineLength = maxLineLength;
+        while (line.size() - pos > lineLength) {
+            std::size_t length = lineLength;
+            //Don't split utf-8 sequences
+            while (length > 1 && (static_cast<unsigned char>(line[pos + length]) & 0xC0) == 0x80) {
+                length--;
+            }
+            mBuffer.append(line, pos, length);
+            mBuffer.append("\r\n ");
+            pos += length;
+            lineLength = maxLineLength - 1; //The leading space counts as well
+        }
+        mBuffer.append(line, pos, std::string::npos);
+        mBuffer.append("\r\n");
+        if (mBuffer.size() >= bufferSize) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (!mBuffer.empty()) {
+            mOutput.write(mBuffer.data(), mBuffer.size());
+            mBuffer.clear();
+        }
+    }
+
+private:
+    static const std::size_t maxLineLength = 75;
+    static const std::size_t bufferSize = 16 * 1024;
+    IFBOutput &mOutput;
+    std::string mBuffer;
+};
+
+class StringOutput: public IFBOutput
 {
-    KCalCore::FreeBusy::Ptr fb(new KCalCore::FreeBusy(Kolab::Conversion::toDate(freebusy.start()), Kolab::Conversion::toDate(freebusy.end())));
-    KCalCore::FreeBusyPeriod::List list;
+public:
+    explicit StringOutput(std::string &string)
+    :   mString(string)
+    {
+    }
+
+    virtual void write(const char *data, std::size_t size)
+    {
+        mString.append(data, size);
+    }
+
+private:
+    std::string &mString;
+};
+//@endcond
+
+static std::string toIcalDateTime(const Kolab::cDateTime &dt)
+{
+    char buffer[20];
+    if (dt.isDateOnly()) {
+        qsnprintf(buffer, sizeof(buffer), "%04d%02d%02d", dt.year(), dt.month(), dt.day());
+        return std::string(buffer);
+    }
+    const Kolab::cDateTime utc = dt.isUTC() ? dt : Calendaring::fromUtcSeconds(Calendaring::toUtcSeconds(dt));
+    qsnprintf(buffer, sizeof(buffer), "%04d%02d%02dT%02d%02d%02dZ", utc.year(), utc.month(), utc.day(), utc.hour(), utc.minute(), utc.second());
+    return std::string(buffer);
+}
+
+static std::string toIcalDateProperty(const char *name, const Kolab::cDateTime &dt)
+{
+    return std::string(name) + (dt.isDateOnly() ? ";VALUE=DATE:" : ":") + toIcalDateTime(dt);
+}
+
+/*
+ * Parameter values may not contain DQUOTE, and must be quoted if they contain ";", ":" or ",".
+ */
+static std::string toIcalParameterValue(const std::string &value)
+{
+    std::string result;
+    result.reserve(value.size() + 2);
+    bool quote = false;
+    for (std::string::const_iterator it = value.begin(); it != value.end(); ++it) {
+        if (*it == '"' || *it == '\r' || *it == '\n') {
+            continue;
+        }
+        if (*it == ';' || *it == ':' || *it == ',') {
+            quote = true;
+        }
+        result.push_back(*it);
+    }
+    if (quote) {
+        return '"' + result + '"';
+    }
+    return result;
+}
+
+static const char *toFBType(const Kolab::FreebusyPeriod &period)
+{
+    switch (period.type()) {
+        case Kolab::FreebusyPeriod::Tentative:
+            return "BUSY-TENTATIVE";
+        case Kolab::FreebusyPeriod::OutOfOffice:
+            return "BUSY-UNAVAILABLE";
+        default:
+            return "BUSY";
+    }
+}
+
+static void addBase64Parameter(std::string &line, const char *name, const std::string &value)
+{
+    if (!value.empty()) {
+        line.append(";").append(name).append("=");
+        line.append(QByteArray(value.data(), value.size()).toBase64().constData());
+    }
+}
+
+void writeIFB(const Kolab::Freebusy &freebusy, IFBOutput &output)
+{
+    IFBLineWriter writer(output);
+    writer.writeLine("BEGIN:VCALENDAR");
+    writer.writeLine(std::string("PRODID:") + LIBKOLAB_LIB_VERSION_STRING);
+    writer.writeLine("VERSION:2.0");
+    writer.writeLine("METHOD:PUBLISH");
+    writer.writeLine("BEGIN:VFREEBUSY");
+    const Kolab::ContactReference &organizer = freebusy.organizer();
+    if (!organizer.email().empty()) {
+        std::string line("ORGANIZER");
+        if (!organizer.name().empty()) {
+            line.append(";CN=").append(toIcalParameterValue(organizer.name()));
+        }
+        writer.writeLine(line + ":MAILTO:" + organizer.email());
+    }
+    writer.writeLine(toIcalDateProperty("DTSTAMP", freebusy.timestamp().isValid() ? freebusy.timestamp() : Kolab::Conversion::fromDate(KDateTime::currentUtcDateTime())));
+    writer.writeLine("UID:" + freebusy.uid());
+    if (freebusy.start().isValid()) {
+        writer.writeLine(toIcalDateProperty("DTSTART", freebusy.start()));
+    }
+    if (freebusy.end().isValid()) {
+        writer.writeLine(toIcalDateProperty("DTEND", freebusy.end()));
+    }
     Q_FOREACH (const Kolab::FreebusyPeriod &fbPeriod, freebusy.periods()) {
+        //The same parameters as KCalCore uses, the event information is base64 encoded
+        std::string parameters(";FBTYPE=");
+        parameters.append(toFBType(fbPeriod));
+        addBase64Parameter(parameters, "X-UID", fbPeriod.eventUid());
+        addBase64Parameter(parameters, "X-SUMMARY", fbPeriod.eventSummary());
+        addBase64Parameter(parameters, "X-LOCATION", fbPeriod.eventLocation());
         Q_FOREACH (const Kolab::Period &p, fbPeriod.periods()) {
-            KCalCore::FreeBusyPeriod period(Kolab::Conversion::toDate(p.start), Kolab::Conversion::toDate(p.end));
-//             period.setSummary("summary"); Doesn't even work. X-SUMMARY is read though (just not written out)
-            //TODO
-            list.append(period);
-            
+            if (!p.start.isValid() || p.start.isDateOnly() || !p.end.isValid() || p.end.isDateOnly()) {
+                Warning() << "invalid period, skipping";
+                continue;
+            }
+            writer.writeLine("FREEBUSY" + parameters + ":" + toIcalDateTime(p.start) + "/" + toIcalDateTime(p.end));
         }
     }
-    fb->addPeriods(list);
+    writer.writeLine("END:VFREEBUSY");
+    writer.writeLine("END:VCALENDAR");
+}
 
-    fb->setUid(QString::fromStdString(freebusy.uid()));
-    fb->setOrganizer(KCalCore::Person::Ptr(new KCalCore::Person(Conversion::fromStdString(freebusy.organizer().name()), Conversion::fromStdString(freebusy.organizer().email()))));
-    fb->setLastModified(Kolab::Conversion::toDate(freebusy.timestamp()));
+void writeIFB(const Kolab::Freebusy &freebusy, std::string &output)
+{
+    StringOutput stringOutput(output);
+    writeIFB(freebusy, stringOutput);
+}
 
-    KCalCore::ICalFormat format;
-    format.setApplication("libkolab", LIBKOLAB_LIB_VERSION_STRING);
-    QString data = format.createScheduleMessage( fb, KCalCore::iTIPPublish );
-    return Conversion::toStdString(data);
+std::string toIFB(const Kolab::Freebusy &freebusy)
+{
+    std::string data;
+    writeIFB(freebusy, data);
+    return data;
 }
 
     }
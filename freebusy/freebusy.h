@@ -28,11 +28,151 @@ namespace Kolab {
     namespace FreebusyUtils {
 
 KOLAB_EXPORT Freebusy generateFreeBusy(const QList<KCalCore::Event::Ptr>& events, const KDateTime& startDate, const KDateTime& endDate, const KCalCore::Person::Ptr &organizer);
+
+/**
+ * Interface to receive the serialized iCalendar freebusy data in chunks.
+ */
+class KOLAB_EXPORT IFBOutput {
+public:
+    virtual ~IFBOutput();
+    virtual void write(const char *data, std::size_t size) = 0;
+};
+
+/**
+ * Serializes the freebusy list as iCalendar VFREEBUSY object (iTIP PUBLISH) in a single pass.
+ *
+ * The busy type is written as FBTYPE, and the event uid, summary and location as
+ * base64 encoded X-UID, X-SUMMARY and X-LOCATION parameters of each FREEBUSY property.
+ * All times are written in UTC.
+ */
+KOLAB_EXPORT void writeIFB(const Kolab::Freebusy &, IFBOutput &);
+/**
+ * Same as above, but appends the output to the string.
+ */
+KOLAB_EXPORT void writeIFB(const Kolab::Freebusy &, std::string &);
 KOLAB_EXPORT std::string toIFB(const Kolab::Freebusy &);
 
-Kolab::Freebusy generateFreeBusy(const std::vector<Kolab::Event> &events, const Kolab::cDateTime &startDate, const Kolab::cDateTime &endDate);
+/**
+ * Generates the freebusy list of the events within the window.
+ *
+ * All periods are Busy, transparent events are skipped.
+ * Exceptions (events with a recurrence-id) replace the matching occurrence of the master event with the same uid,
+ * and are added as separate FreebusyPeriod after the master.
+ */
+KOLAB_EXPORT Kolab::Freebusy generateFreeBusy(const std::vector<Kolab::Event> &events, const Kolab::cDateTime &startDate, const Kolab::cDateTime &endDate);
+
+/**
+ * Same as above, but if @param simple is true, the event information of the periods is not set.
+ *
+ * If @param merge is true, a compact list is returned: tentative events are added as Tentative periods, cancelled events are skipped,
+ * and there is a single sorted FreebusyPeriod per busy type in which the overlapping and adjacent periods are merged
+ * (the event information is always dropped in that case).
+ */
+KOLAB_EXPORT Kolab::Freebusy generateFreeBusy(const std::vector<Kolab::Event> &events, const Kolab::cDateTime &startDate, const Kolab::cDateTime &endDate, bool simple, bool merge = false);
+
+/**
+ * A single job for the batch generation of freebusy lists.
+ */
+struct KOLAB_EXPORT FreebusyRequest {
+    std::string organizerEmail;
+    std::string organizerName;
+    std::vector<Kolab::Event> events;
+    Kolab::cDateTime start;
+    Kolab::cDateTime end;
+};
+
+/**
+ * Interface to receive the results of the batch generation.
+ *
+ * result() is called as soon as a job is completed, from the thread that processed it
+ * (a pool thread or the calling thread), so it may be called concurrently.
+ */
+class KOLAB_EXPORT FreebusyResultHandler {
+public:
+    virtual ~FreebusyResultHandler();
+    /**
+     * @param index the index of the request
+     */
+    virtual void result(int index, const Kolab::Freebusy &) = 0;
+};
+
+/**
+ * Generates the freebusy lists of all requests concurrently, using the threads of QThreadPool::globalInstance().
+ *
+ * Since KSystemTimeZones and KCalCore are not thread-safe, only requests with UTC values (window and events)
+ * and natively supported recurrences are processed concurrently. All other requests are processed in the calling thread.
+ *
+ * Blocks until all requests are processed. The organizer of each list is set from the request.
+ */
+KOLAB_EXPORT void generateFreeBusy(const std::vector<FreebusyRequest> &, FreebusyResultHandler &);
+
+/**
+ * Same as above, but returns the results in the order of the requests.
+ */
+KOLAB_EXPORT std::vector<Kolab::Freebusy> generateFreeBusy(const std::vector<FreebusyRequest> &);
+
+/**
+ * Freebusy list of a set of events, which is updated incrementally.
+ *
+ * The busy periods of each event are kept by uid, so adding, modifying or removing an event
+ * only expands this single event, instead of regenerating the whole list with generateFreeBusy().
+ * The periods are the same as generateFreeBusy() produces, but ordered by event uid.
+ *
+ * The window must be given as date-time values.
+ */
+class KOLAB_EXPORT FreebusyCache {
+public:
+    FreebusyCache(const Kolab::cDateTime &startDate, const Kolab::cDateTime &endDate);
+    ~FreebusyCache();
+
+    /**
+     * Adds the event, or replaces the existing event with the same uid.
+     *
+     * Exceptions (events with a recurrence-id) replace the existing exception with the same recurrence-id,
+     * and the master with the same uid is expanded again.
+     */
+    void addEvent(const Kolab::Event &);
+    /**
+     * Removes the event including all its exceptions.
+     */
+    void removeEvent(const std::string &uid);
+    /**
+     * Removes the exception with the recurrence-id, and expands the master with the same uid again.
+     *
+     * If the recurrence-id is invalid, only the master is removed and its exceptions are kept.
+     */
+    void removeEvent(const std::string &uid, const Kolab::cDateTime &recurrenceId);
+    void clear();
+
+    void setOrganizer(const Kolab::ContactReference &);
+
+    /**
+     * Returns the current freebusy list, with a new uid and timestamp.
+     */
+    Kolab::Freebusy freebusy() const;
+
+private:
+    //@cond PRIVATE
+    FreebusyCache(const FreebusyCache &other);
+    FreebusyCache &operator=(const FreebusyCache &rhs);
+    class Private;
+    Private *const d;
+    //@endcond
+};
+/**
+ * Aggregates the freebusy lists of multiple users into a single one.
+ *
+ * If @param simple is true, the event information of the periods is not copied.
+ */
 KOLAB_EXPORT Kolab::Freebusy aggregateFreeBusy(const std::vector<Kolab::Freebusy> &fbs, const std::string &organizerEmail, const std::string &organizerName, bool simple = true);
 
+/**
+ * Same as above, but if @param merge is true, the overlapping and adjacent periods of each busy type are merged,
+ * and a single sorted FreebusyPeriod is returned per busy type (the event information is always dropped in that case).
+ * All periods are converted to UTC.
+ */
+KOLAB_EXPORT Kolab::Freebusy aggregateFreeBusy(const std::vector<Kolab::Freebusy> &fbs, const std::string &organizerEmail, const std::string &organizerName, bool simple, bool merge);
+
     }
 }
 
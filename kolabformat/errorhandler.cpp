@@ -21,7 +21,9 @@
 #include <qdebug.h>
 #include <QTime>
 #include <QStringList>
-#include <qmutex.h>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QThreadStorage>
 #include <iostream>
 
 #include <kolabformat.h>
@@ -35,7 +37,10 @@ QDebug operator<<(QDebug dbg, const std::string &s)
 namespace Kolab {
 
 DebugStream::DebugStream()
-:   QIODevice()
+:   QIODevice(),
+    m_file(0),
+    m_line(0),
+    m_severity(ErrorHandler::Debug)
 {
     open(WriteOnly);
 }
@@ -45,16 +50,44 @@ DebugStream::~DebugStream(){}
 qint64 DebugStream::writeData(const char *data, qint64 len) {
     const QByteArray buf = QByteArray::fromRawData(data, len);
 //         qt_message_output(QtDebugMsg, buf.trimmed().constData());
-    ErrorHandler::instance().addError(m_severity, buf, m_location);
+    ErrorHandler::instance().addError(m_severity, buf, m_file, m_line);
     return len;
 }
 
 
-QMutex mutex;
-    
-void logMessage(const QString &message, const QString &file, int line, ErrorHandler::Severity s)
+ErrorSink::~ErrorSink()
 {
-    ErrorHandler::instance().addError(s, message, file+" "+QString::number(line));
+}
+
+//@cond PRIVATE
+class ConsoleSink: public ErrorSink
+{
+public:
+    virtual void log(const Record &record)
+    {
+        QString filename = QString::fromLatin1(record.file);
+        if (!filename.split(QLatin1Char('/')).isEmpty()) {
+           filename = filename.split(QLatin1Char('/')).last();
+        }
+        if (record.line >= 0) {
+            filename += QLatin1Char('(') + QString::number(record.line) + QLatin1Char(')');
+        }
+        const QString output = QTime::currentTime().toString(QLatin1String("(hh:mm:ss) ")) + filename + QLatin1String(":\t") + record.message;
+        std::cout << output.toStdString() << std::endl;
+    }
+};
+//@endcond
+
+static ConsoleSink consoleSink;
+static QAtomicPointer<ErrorSink> errorSink(0);
+static QAtomicInt severityThreshold(ErrorHandler::Warning);
+
+void logMessage(const QString &message, const char *file, int line, ErrorHandler::Severity s)
+{
+    if (!ErrorHandler::isEnabled(s)) {
+        return;
+    }
+    ErrorHandler::instance().addError(s, message, file, line);
 }
 
 ErrorHandler::ErrorHandler()
@@ -64,26 +97,76 @@ ErrorHandler::ErrorHandler()
 
 };
 
-QDebug ErrorHandler::debugStream(ErrorHandler::Severity severity, int line, const char* file)
+static QThreadStorage<ErrorHandler*> threadErrorHandler;
+
+ErrorHandler &ErrorHandler::instance()
 {
-    QMutexLocker locker(&mutex);
-    ErrorHandler::instance().m_debugStream->m_location = QString(QString(file) + "(" + QString::number(line)+")");
-    ErrorHandler::instance().m_debugStream->m_severity = severity;
-    return QDebug(ErrorHandler::instance().m_debugStream.data());
+    if (!threadErrorHandler.hasLocalData()) {
+        threadErrorHandler.setLocalData(new ErrorHandler);
+    }
+    return *threadErrorHandler.localData();
 }
 
-void ErrorHandler::addError(ErrorHandler::Severity s, const QString& message, const QString &location)
+void ErrorHandler::setSink(ErrorSink *sink)
 {
-    QMutexLocker locker(&mutex);
-    QString filename = location;
-    if (!filename.split(QLatin1Char('/')).isEmpty()) {
-       filename = filename.split(QLatin1Char('/')).last();
+    errorSink = sink;
+}
+
+void ErrorHandler::setConsoleOutput(bool enable)
+{
+    if (enable) {
+        errorSink = &consoleSink;
+    } else {
+        //Don't remove a sink which has been installed by the user
+        errorSink.testAndSetOrdered(&consoleSink, 0);
     }
-    const QString output = QTime::currentTime().toString(QLatin1String("(hh:mm:ss) ")) + filename + QLatin1String(":\t") + message;
-    std::cout << output.toStdString() << std::endl;
-    if (s == Debug) {
+}
+
+void ErrorHandler::setObjectUid(const QString &uid)
+{
+    instance().m_objectUid = uid;
+}
+
+void ErrorHandler::setSeverityThreshold(Severity severity)
+{
+    severityThreshold = severity;
+}
+
+bool ErrorHandler::isEnabled(Severity severity)
+{
+    if (severity >= Warning) {
+        return true;
+    }
+    ErrorSink *sink = errorSink;
+    return sink && severity >= severityThreshold;
+}
+
+QDebug ErrorHandler::debugStream(ErrorHandler::Severity severity, int line, const char* file)
+{
+    ErrorHandler &handler = ErrorHandler::instance();
+    handler.m_debugStream->m_file = file;
+    handler.m_debugStream->m_line = line;
+    handler.m_debugStream->m_severity = severity;
+    return QDebug(handler.m_debugStream.data());
+}
+
+void ErrorHandler::notifySink(ErrorHandler::Severity s, const QString &message, const QByteArray &file, int line)
+{
+    ErrorSink *sink = errorSink;
+    if (!sink || s < severityThreshold) {
         return;
     }
+    ErrorSink::Record record;
+    record.severity = s;
+    record.file = file;
+    record.line = line;
+    record.objectUid = m_objectUid;
+    record.message = message;
+    sink->log(record);
+}
+
+void ErrorHandler::recordError(ErrorHandler::Severity s, const QString &message, const QString &location)
+{
     if (s > m_worstError) {
         m_worstError = s;
         m_worstErrorMessage = message;
@@ -91,29 +174,53 @@ void ErrorHandler::addError(ErrorHandler::Severity s, const QString& message, co
     m_errorQueue.append(Err(s, message, location));
 }
 
+void ErrorHandler::addError(ErrorHandler::Severity s, const QString& message, const char *file, int line)
+{
+    if (s < Warning && !isEnabled(s)) {
+        return;
+    }
+    //__FILE__ is a literal with static storage, so it doesn't have to be copied
+    notifySink(s, message, QByteArray::fromRawData(file, qstrlen(file)), line);
+    if (s == Debug) {
+        return;
+    }
+    //The location is only assembled for messages which are actually recorded
+    recordError(s, message, QString::fromLatin1(file) + QLatin1Char('(') + QString::number(line) + QLatin1Char(')'));
+}
+
+void ErrorHandler::addError(ErrorHandler::Severity s, const QString& message, const QString &location)
+{
+    if (s < Warning && !isEnabled(s)) {
+        return;
+    }
+    notifySink(s, message, location.toLatin1(), -1);
+    if (s == Debug) {
+        return;
+    }
+    recordError(s, message, location);
+}
+
 ErrorHandler::Severity ErrorHandler::error() const
 {
-    QMutexLocker locker(&mutex);
     return m_worstError;
 }
 
 QString ErrorHandler::errorMessage() const
 {
-    QMutexLocker locker(&mutex);
     return m_worstErrorMessage;
 }
 
 const QList< ErrorHandler::Err >& ErrorHandler::getErrors() const
 {
-    QMutexLocker locker(&mutex);
     return m_errorQueue;
 }
 
 void ErrorHandler::clear()
 {
-    QMutexLocker locker(&mutex);
     m_errorQueue.clear();
     m_worstError = Debug;
+    m_worstErrorMessage.clear();
+    m_objectUid.clear();
 }
 
 void ErrorHandler::handleLibkolabxmlErrors()
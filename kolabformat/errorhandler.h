@@ -28,6 +28,7 @@
 namespace Kolab {
 
 class DebugStream;
+class ErrorSink;
 /**
  * Kolab Error Handler
  * 
@@ -39,8 +40,13 @@ class DebugStream;
  * 
  * all non-const functions are not for the user of this class and only exist for internal usage.
  * 
+ * Each thread has its own error handler, so operations running concurrently in different threads
+ * don't see each others errors. instance() always returns the error handler of the calling thread.
+ * Because the state is never shared between threads, reporting an error doesn't require any locking.
+ * 
+ * Errors are not printed anywhere unless a sink is installed using setSink() (or setConsoleOutput()).
+ * 
  * TODO: Hide everything which is not meant for the user from the interface.
- * FIXME: Use Threadlocal storage to make this threadsafe.
  */
 class KOLAB_EXPORT ErrorHandler
 {
@@ -59,13 +65,10 @@ public:
         QString location;
     };
     
-    static ErrorHandler &instance()
-    {
-        static ErrorHandler inst;
-        return inst;
-    }
+    static ErrorHandler &instance();
     
     void addError(Severity s, const QString &message, const QString &location);
+    void addError(Severity s, const QString &message, const char *file, int line);
     const QList <Err> &getErrors() const;
     Severity error() const;
     QString errorMessage() const;
@@ -81,6 +84,40 @@ public:
         ErrorHandler::instance().clear();
     }
     
+    /**
+     * Installs a sink which receives all reported messages from all threads.
+     * 
+     * The sink is not owned by the error handler and must remain valid until it is replaced or removed by passing 0.
+     */
+    static void setSink(ErrorSink *);
+
+    /**
+     * Enables or disables printing of all reported errors to stdout.
+     * 
+     * This installs respectively removes a sink which prints to stdout, it is disabled by default.
+     */
+    static void setConsoleOutput(bool);
+
+    /**
+     * Sets the uid of the object which is currently processed in this thread.
+     * 
+     * The uid is passed to the sink along with every message, until the next call to clear().
+     */
+    static void setObjectUid(const QString &uid);
+
+    /**
+     * Sets the minimum severity of messages which are passed to the sink (default: Warning).
+     * 
+     * Warnings and worse are always recorded, debug messages below the threshold are discarded
+     * before any formatting takes place.
+     */
+    static void setSeverityThreshold(Severity);
+
+    /**
+     * Returns true if a message of the given severity would be recorded or printed.
+     */
+    static bool isEnabled(Severity);
+
     static bool errorOccured()
     {
         if (ErrorHandler::instance().error() >= Error) {
@@ -98,14 +135,43 @@ private:
     ErrorHandler();
     ErrorHandler(const ErrorHandler &);
     ErrorHandler & operator= (const ErrorHandler &);
+
+    void notifySink(Severity s, const QString &message, const QByteArray &file, int line);
+    void recordError(Severity s, const QString &message, const QString &location);
     
     Severity m_worstError;
     QString m_worstErrorMessage;
+    QString m_objectUid;
     QList <Err> m_errorQueue;
     QScopedPointer<DebugStream> m_debugStream;
 };
 
-void logMessage(const QString &,const QString &, int, ErrorHandler::Severity s);
+/**
+ * Interface for log sinks
+ * 
+ * Instead of a preformatted string the sink gets the individual fields of each message,
+ * so it can format, filter or aggregate them as needed.
+ * 
+ * Since the sink is shared by all threads, log() may be called concurrently.
+ * The records can be copied and processed after log() returned, e.g. by an asynchronous sink.
+ */
+class KOLAB_EXPORT ErrorSink
+{
+public:
+    struct Record {
+        ErrorHandler::Severity severity;
+        //Owns its data (unless it refers to a __FILE__ literal), so records may be stored and processed later
+        QByteArray file;
+        int line; //-1 if not available
+        QString objectUid;
+        QString message;
+    };
+
+    virtual ~ErrorSink();
+    virtual void log(const Record &) = 0;
+};
+
+void logMessage(const QString &,const char *, int, ErrorHandler::Severity s);
 
 #define LOG(message) logMessage(message,__FILE__, __LINE__, ErrorHandler::Debug);
 #define WARNING(message) logMessage(message,__FILE__, __LINE__, ErrorHandler::Warning);
@@ -116,7 +182,8 @@ void logMessage(const QString &,const QString &, int, ErrorHandler::Severity s);
 class DebugStream: public QIODevice
 {
 public:
-    QString m_location;
+    const char *m_file;
+    int m_line;
     ErrorHandler::Severity m_severity;
     DebugStream();
     virtual ~DebugStream();
@@ -128,7 +195,8 @@ private:
     Q_DISABLE_COPY(DebugStream)
 };
 
-#define Debug() Kolab::ErrorHandler::debugStream(Kolab::ErrorHandler::Debug, __LINE__, __FILE__)
+//Debug messages are usually disabled, so we avoid creating the stream and formatting the message
+#define Debug() if (!Kolab::ErrorHandler::isEnabled(Kolab::ErrorHandler::Debug)) {} else Kolab::ErrorHandler::debugStream(Kolab::ErrorHandler::Debug, __LINE__, __FILE__)
 #define Warning() Kolab::ErrorHandler::debugStream(Kolab::ErrorHandler::Warning, __LINE__, __FILE__)
 #define Error() Kolab::ErrorHandler::debugStream(Kolab::ErrorHandler::Error, __LINE__, __FILE__)
 #define Critical() Kolab::ErrorHandler::debugStream(Kolab::ErrorHandler::Critical, __LINE__, __FILE__)
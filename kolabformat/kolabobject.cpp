@@ -18,6 +18,7 @@
 
 #include "kolabobject.h"
 #include "v2helpers.h"
+#include "v3helpers.h"
 #include "kolabdefinitions.h"
 #include "errorhandler.h"
 #include "libkolab-version.h"
@@ -36,6 +37,11 @@
 #include <conversion/commonconversion.h>
 #include <akonadi/notes/noteutils.h>
 #include <kolabformat.h>
+#include <kmime/kmime_util.h>
+#include <kglobal.h>
+#include <kcharsets.h>
+#include <QtConcurrentMap>
+#include <cstring>
 
 
 namespace Kolab {
@@ -150,6 +156,45 @@ KOLAB_EXPORT QString generateMemberUrl(const RelationMember &member)
 }
 
 //@cond PRIVATE
+/*
+ * The libkolabxml container of a v3 incidence, parsed ahead of the conversion by KolabObjectBatchReader.
+ */
+struct ParsedIncidence
+{
+    ParsedIncidence()
+    :   type(InvalidObject),
+        error(Kolab::NoError)
+    {
+    }
+
+    ObjectType type;
+    Kolab::Event event;
+    Kolab::Todo todo;
+    Kolab::Journal journal;
+    Kolab::ErrorSeverity error;
+    std::string errorMessage;
+};
+
+/*
+ * Same as ErrorHandler::handleLibkolabxmlErrors(), for an error recorded in another thread.
+ */
+static void reportLibkolabxmlError(Kolab::ErrorSeverity severity, const std::string &message)
+{
+    switch (severity) {
+        case Kolab::Warning:
+            ErrorHandler::instance().addError(ErrorHandler::Warning, QString::fromStdString(message), "libkolabxml");
+            break;
+        case Kolab::Error:
+            ErrorHandler::instance().addError(ErrorHandler::Error, QString::fromStdString(message), "libkolabxml");
+            break;
+        case Kolab::Critical:
+            ErrorHandler::instance().addError(ErrorHandler::Critical, QString::fromStdString(message), "libkolabxml");
+            break;
+        default:
+            break;
+    }
+}
+
 class KolabObjectReader::Private
 {
 public:
@@ -157,7 +202,9 @@ public:
     :   mObjectType( InvalidObject ),
         mVersion( KolabV3 ),
         mOverrideObjectType(InvalidObject),
-        mDoOverrideVersion(false)
+        mDoOverrideVersion(false),
+        mAttachmentPolicy(KolabObjectReader::LoadAttachments),
+        mParsedIncidence(0)
     {
         mAddressee = KABC::Addressee();
     }
@@ -177,6 +224,11 @@ public:
     ObjectType mOverrideObjectType;
     Version mOverrideVersion;
     bool mDoOverrideVersion;
+    KolabObjectReader::AttachmentPolicy mAttachmentPolicy;
+    //Only kept for ReferenceAttachments
+    KMime::Message::Ptr mMessage;
+    //Used instead of parsing the xml if it matches the object type, only set while KolabObjectBatchReader reads the message
+    const ParsedIncidence *mParsedIncidence;
 
 #ifdef HAVE_RELATION_H
     Akonadi::Relation mRelation;
@@ -215,6 +267,11 @@ void KolabObjectReader::setVersion(Version version)
     d->mDoOverrideVersion = true;
 }
 
+void KolabObjectReader::setAttachmentPolicy(AttachmentPolicy policy)
+{
+    d->mAttachmentPolicy = policy;
+}
+
 Kolab::ObjectType getObjectType(const QString &type)
 {
     if (type == eventKolabType()) {
@@ -321,7 +378,8 @@ ObjectType KolabObjectReader::Private::readKolabV2(const KMime::Message::Ptr &ms
         mObjectType = objectType;
         return mObjectType;
     }
-    KMime::Content *xmlContent = Mime::findContentByType( msg, getTypeString(objectType)  );
+    const Mime::PartIndex parts(msg);
+    KMime::Content *xmlContent = parts.findByType( getTypeString(objectType)  );
     if ( !xmlContent ) {
         Critical() << "no part with type" << getTypeString(objectType) << " found";
         printMessageDebugInfo(msg);
@@ -354,10 +412,11 @@ ObjectType KolabObjectReader::Private::readKolabV2(const KMime::Message::Ptr &ms
             CRITICAL("no kolab object found ");
             break;
     }
+    //Attachments are referenced by name in v2, ReferenceAttachments and SkipAttachments therefore load them as well
     if (!mIncidence.isNull()) {
 //             kDebug() << "v2 attachments " << attachments.size() << d->mIncidence->attachments().size();
         mIncidence->clearAttachments();
-        Mime::getAttachments(mIncidence, attachments, msg);
+        Mime::getAttachments(mIncidence, attachments, parts);
         if (mIncidence->attachments().size() != attachments.size()) {
             Error() << "Could not extract all attachments. " << mIncidence->attachments().size() << " out of " << attachments.size();
         }
@@ -372,29 +431,43 @@ ObjectType KolabObjectReader::Private::readKolabV2(const KMime::Message::Ptr &ms
 
 ObjectType KolabObjectReader::Private::readKolabV3(const KMime::Message::Ptr &msg, Kolab::ObjectType objectType)
 {
-    KMime::Content * const xmlContent = Mime::findContentByType( msg, getMimeType(objectType) );
-    if ( !xmlContent ) {
-        Critical() << "no " << getMimeType(objectType) << " part found";
-        printMessageDebugInfo(msg);
-        return InvalidObject;
+    const Mime::PartIndex parts(msg);
+    const ParsedIncidence * const parsed = (mParsedIncidence && mParsedIncidence->type == objectType) ? mParsedIncidence : 0;
+    std::string xml;
+    if (!parsed) {
+        KMime::Content * const xmlContent = parts.findByType( getMimeType(objectType) );
+        if ( !xmlContent ) {
+            Critical() << "no " << getMimeType(objectType) << " part found";
+            printMessageDebugInfo(msg);
+            return InvalidObject;
+        }
+        const QByteArray &content = xmlContent->decodedContent();
+        xml = std::string(content.data(), content.size());
     }
-    const QByteArray &content = xmlContent->decodedContent();
-    const std::string xml = std::string(content.data(), content.size());
     switch (objectType) {
-        case EventObject: {
-            const Kolab::Event & event = Kolab::readEvent(xml, false);
-            mIncidence = Kolab::Conversion::toKCalCore(event);
-        }
+        case EventObject:
+            if (parsed) {
+                mIncidence = Kolab::Conversion::toKCalCore(parsed->event);
+            } else {
+                const Kolab::Event & event = Kolab::readEvent(xml, false);
+                mIncidence = Kolab::Conversion::toKCalCore(event);
+            }
             break;
-        case TodoObject: {
-            const Kolab::Todo & event = Kolab::readTodo(xml, false);
-            mIncidence = Kolab::Conversion::toKCalCore(event);
-        }
+        case TodoObject:
+            if (parsed) {
+                mIncidence = Kolab::Conversion::toKCalCore(parsed->todo);
+            } else {
+                const Kolab::Todo & event = Kolab::readTodo(xml, false);
+                mIncidence = Kolab::Conversion::toKCalCore(event);
+            }
             break;
-        case JournalObject: {
-            const Kolab::Journal & event = Kolab::readJournal(xml, false);
-            mIncidence = Kolab::Conversion::toKCalCore(event);
-        }
+        case JournalObject:
+            if (parsed) {
+                mIncidence = Kolab::Conversion::toKCalCore(parsed->journal);
+            } else {
+                const Kolab::Journal & event = Kolab::readJournal(xml, false);
+                mIncidence = Kolab::Conversion::toKCalCore(event);
+            }
             break;
         case ContactObject: {
             const Kolab::Contact &contact = Kolab::readContact(xml, false);
@@ -472,9 +545,24 @@ ObjectType KolabObjectReader::Private::readKolabV3(const KMime::Message::Ptr &ms
 
     if (!mIncidence.isNull()) {
 //             kDebug() << "getting attachments";
-        Mime::getAttachmentsById(mIncidence, msg);
+        switch (mAttachmentPolicy) {
+            case KolabObjectReader::LoadAttachments:
+                Mime::getAttachmentsById(mIncidence, parts);
+                break;
+            case KolabObjectReader::ReferenceAttachments:
+                Mime::getAttachmentReferencesById(mIncidence, parts);
+                mMessage = msg;
+                break;
+            case KolabObjectReader::SkipAttachments:
+                break;
+        }
+    }
+    if (parsed) {
+        //The libkolabxml errors were recorded in the thread which parsed the xml
+        reportLibkolabxmlError(parsed->error, parsed->errorMessage);
+    } else {
+        ErrorHandler::handleLibkolabxmlErrors();
     }
-    ErrorHandler::handleLibkolabxmlErrors();
     if (ErrorHandler::errorOccured()) {
         printMessageDebugInfo(msg);
         return InvalidObject;
@@ -483,15 +571,28 @@ ObjectType KolabObjectReader::Private::readKolabV3(const KMime::Message::Ptr &ms
     return mObjectType;
 }
 
+static KMime::Headers::Base *getVersionHeader(const KMime::Message::Ptr &msg)
+{
+    KMime::Headers::Base *xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER);
+    if (!xKolabVersion) {
+        //For backwards compatibility to development versions, can be removed in future versions
+        xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER_COMPAT);
+    }
+    return xKolabVersion;
+}
+
 ObjectType KolabObjectReader::parseMimeMessage(const KMime::Message::Ptr &msg)
 {
     ErrorHandler::clearErrors();
     d->mObjectType = InvalidObject;
+    d->mMessage.reset();
     if (msg->contents().isEmpty()) {
         Critical() << "message has no contents (we likely failed to parse it correctly)";
         printMessageDebugInfo(msg);
         return InvalidObject;
     }
+    //The subject contains the uid of the object
+    ErrorHandler::setObjectUid(msg->subject()->asUnicodeString());
     Kolab::ObjectType objectType = InvalidObject;
     if (d->mOverrideObjectType == InvalidObject) {
         if (KMime::Headers::Base *xKolabHeader = msg->getHeaderByType(X_KOLAB_TYPE_HEADER)) {
@@ -511,11 +612,7 @@ ObjectType KolabObjectReader::parseMimeMessage(const KMime::Message::Ptr &msg)
     }
 
     if (!d->mDoOverrideVersion) {
-        KMime::Headers::Base *xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER);
-        if (!xKolabVersion) {
-            //For backwards compatibility to development versions, can be removed in future versions
-            xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER_COMPAT);
-        }
+        KMime::Headers::Base *xKolabVersion = getVersionHeader(msg);
         if (!xKolabVersion || xKolabVersion->asUnicodeString() == KOLAB_VERSION_V2) {
             d->mVersion = KolabV2;
         } else {
@@ -534,6 +631,73 @@ ObjectType KolabObjectReader::parseMimeMessage(const KMime::Message::Ptr &msg)
     return d->readKolabV3(msg, objectType);
 }
 
+KolabHeaders sniffKolabHeaders(const char *data, std::size_t size)
+{
+    QByteArray kolabType;
+    QByteArray version;
+    QByteArray compatVersion;
+    QByteArray subject;
+    QByteArray *current = 0;
+
+    const char * const end = data + size;
+    const char *line = data;
+    while (line < end) {
+        const char *lineEnd = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        int length = lineEnd - line;
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
+        }
+        if (length == 0) { //The empty line terminates the header block
+            break;
+        }
+        if (line[0] == ' ' || line[0] == '\t') {
+            //Folded header, continues the previous one
+            if (current) {
+                current->append(line, length);
+            }
+        } else {
+            current = 0;
+            const char *colon = static_cast<const char*>(memchr(line, ':', length));
+            if (colon) {
+                const QByteArray name = QByteArray(line, colon - line).trimmed();
+                QByteArray *value = 0;
+                if (qstricmp(name.constData(), X_KOLAB_TYPE_HEADER) == 0) {
+                    value = &kolabType;
+                } else if (qstricmp(name.constData(), X_KOLAB_MIME_VERSION_HEADER) == 0) {
+                    value = &version;
+                } else if (qstricmp(name.constData(), X_KOLAB_MIME_VERSION_HEADER_COMPAT) == 0) {
+                    value = &compatVersion;
+                } else if (qstricmp(name.constData(), "Subject") == 0) {
+                    value = &subject;
+                }
+                //Like KMime we use the first occurrence of a header
+                if (value && value->isNull()) {
+                    *value = QByteArray(colon + 1, length - (colon + 1 - line));
+                    current = value;
+                }
+            }
+        }
+        line = lineEnd + 1;
+    }
+
+    KolabHeaders headers;
+    if (!kolabType.isNull()) {
+        headers.type = getObjectType(QString::fromLatin1(kolabType.trimmed()));
+    }
+    if (version.isNull()) {
+        //For backwards compatibility to development versions, can be removed in future versions
+        version = compatVersion;
+    }
+    version = version.trimmed();
+    headers.version = (version.isNull() || version == KOLAB_VERSION_V2) ? KolabV2 : KolabV3;
+    QByteArray usedCharset;
+    headers.uid = KMime::decodeRFC2047String(subject.trimmed(), usedCharset, "utf-8").trimmed();
+    return headers;
+}
+
 Version KolabObjectReader::getVersion() const
 {
     return d->mVersion;
@@ -590,6 +754,22 @@ Freebusy KolabObjectReader::getFreebusy() const
     return d->mFreebusy;
 }
 
+QByteArray KolabObjectReader::getAttachmentData(const QString &uri) const
+{
+    if (!d->mMessage) {
+        Error() << "no message available, the attachments must be referenced using ReferenceAttachments";
+        return QByteArray();
+    }
+    QByteArray type;
+    QString name;
+    KMime::Content *content = Mime::findContentById(d->mMessage, Mime::fromCid(uri).toLatin1(), type, name);
+    if (!content) {
+        Error() << "could not find attachment: " << uri;
+        return QByteArray();
+    }
+    return content->decodedContent();
+}
+
 #ifdef HAVE_TAG_H
 bool KolabObjectReader::isTag() const
 {
@@ -619,13 +799,332 @@ Akonadi::Relation KolabObjectReader::getRelation() const
 }
 #endif
 
+//@cond PRIVATE
+struct BatchItem
+{
+    BatchItem()
+    :   severity(ErrorHandler::Debug),
+        overrideObjectType(InvalidObject),
+        doOverrideVersion(false),
+        attachmentPolicy(KolabObjectReader::LoadAttachments)
+    {
+    }
+
+    KMime::Message::Ptr message;
+    QByteArray content;
+    ParsedIncidence parsed;
+    KolabObjectReader reader;
+    ErrorHandler::Severity severity;
+    QString errorMessage;
+    QList<ErrorHandler::Err> errors;
+    ObjectType overrideObjectType;
+    Version overrideVersion;
+    bool doOverrideVersion;
+    KolabObjectReader::AttachmentPolicy attachmentPolicy;
+};
+
+static void primeCharset(const QByteArray &charset)
+{
+    const QByteArray cached = KMime::cachedCharset(charset);
+    KGlobal::charsets()->codecForName(QString::fromLatin1(cached));
+    KGlobal::charsets()->codecForName(QString::fromLatin1(charset));
+}
+
+static bool isCharsetCharacter(char c)
+{
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' || c == ':';
+}
+
+/*
+ * Returns the charset name starting at @param begin, if it is terminated by one of @param terminators.
+ */
+static QByteArray charsetAt(const char *begin, const char *end, const char *terminators)
+{
+    const char *c = begin;
+    while (c < end && c - begin < 64 && isCharsetCharacter(*c)) {
+        c++;
+    }
+    if (c == begin || (c < end && !strchr(terminators, *c))) {
+        return QByteArray();
+    }
+    return QByteArray(begin, c - begin);
+}
+
+/*
+ * KMime looks up charsets with KMime::cachedCharset() and KCharsets, which both add to process-global caches without locking.
+ *
+ * So the charsets a message refers to ("charset=" and RFC 2231 parameters, RFC 2047 encoded words)
+ * are looked up in the calling thread before the messages are parsed concurrently, which then only read the caches.
+ */
+static void primeCharsets(const QByteArray &content)
+{
+    const char * const end = content.constData() + content.size();
+    const char *c = content.constData();
+    while ((c = static_cast<const char*>(memchr(c, '=', end - c)))) {
+        QByteArray charset;
+        if (c + 1 < end && c[1] == '?') {
+            charset = charsetAt(c + 2, end, "?*");
+        } else if (c > content.constData() && c[-1] == '*') {
+            charset = charsetAt(c + 1, end, "'");
+        } else if (c - content.constData() >= 7 && !qstrnicmp(c - 7, "charset", 7)) {
+            const char *begin = (c + 1 < end && c[1] == '"') ? c + 2 : c + 1;
+            charset = charsetAt(begin, end, "\"; \t\r\n");
+        }
+        if (!charset.isEmpty()) {
+            primeCharset(charset);
+        }
+        c++;
+    }
+}
 
-//Normalize incidences before serializing them
-KCalCore::Incidence::Ptr normalizeIncidence(KCalCore::Incidence::Ptr original)
+/*
+ * Parses the xml of v3 events, todos and journals, which doesn't involve KCalCore or KSystemTimeZones.
+ *
+ * The conversion is done by the reader in the calling thread, all other objects are read there completely.
+ * Errors are left to the reader as well, which reports them when it reads the message.
+ */
+static void parseIncidenceXml(BatchItem *item)
+{
+    const KMime::Message::Ptr &msg = item->message;
+    if (msg->contents().isEmpty()) {
+        return;
+    }
+    ObjectType type = item->overrideObjectType;
+    if (type == InvalidObject) {
+        KMime::Headers::Base *xKolabHeader = msg->getHeaderByType(X_KOLAB_TYPE_HEADER);
+        if (!xKolabHeader) {
+            return;
+        }
+        type = getObjectType(xKolabHeader->asUnicodeString().trimmed());
+    }
+    if (type != EventObject && type != TodoObject && type != JournalObject) {
+        return;
+    }
+    if (item->doOverrideVersion) {
+        if (item->overrideVersion != KolabV3) {
+            return;
+        }
+    } else {
+        KMime::Headers::Base *xKolabVersion = getVersionHeader(msg);
+        if (!xKolabVersion || xKolabVersion->asUnicodeString() == KOLAB_VERSION_V2) {
+            return;
+        }
+    }
+    KMime::Content *xmlContent = Mime::findContentByType(msg, getMimeType(type));
+    if (!xmlContent) {
+        return;
+    }
+    const QByteArray content = xmlContent->decodedContent();
+    const std::string xml(content.constData(), content.size());
+    ParsedIncidence &parsed = item->parsed;
+    switch (type) {
+        case EventObject:
+            parsed.event = Kolab::readEvent(xml, false);
+            break;
+        case TodoObject:
+            parsed.todo = Kolab::readTodo(xml, false);
+            break;
+        default:
+            parsed.journal = Kolab::readJournal(xml, false);
+            break;
+    }
+    //libkolabxml keeps its error state per thread
+    parsed.error = Kolab::error();
+    parsed.errorMessage = Kolab::errorMessage();
+    parsed.type = type;
+}
+
+/*
+ * Parses the raw message if necessary, and the xml of v3 incidences. Runs concurrently.
+ *
+ * The charsets were primed before, and KMime doesn't share any other state between messages.
+ */
+static void parseBatchItem(BatchItem *item)
+{
+    if (!item->message) {
+        item->message = KMime::Message::Ptr(new KMime::Message);
+        item->message->setContent(item->content);
+        item->message->parse();
+        item->content.clear();
+    }
+    parseIncidenceXml(item);
+}
+
+/*
+ * Reads the object from the parsed message, using the parsed xml if available.
+ *
+ * The conversion uses KSystemTimeZones, which fills a process-global zone cache lazily, and KTimeZone,
+ * which is reference counted and caches lookups, both without locking. So this has to run in a single thread.
+ */
+static void readBatchItem(BatchItem *item)
+{
+    ErrorHandler::clearErrors();
+    if (item->overrideObjectType != InvalidObject) {
+        item->reader.setObjectType(item->overrideObjectType);
+    }
+    if (item->doOverrideVersion) {
+        item->reader.setVersion(item->overrideVersion);
+    }
+    item->reader.setAttachmentPolicy(item->attachmentPolicy);
+    item->reader.parseMimeMessage(item->message);
+    //The error handler was cleared above, so it only contains the errors of this message
+    const ErrorHandler &errorHandler = ErrorHandler::instance();
+    item->severity = errorHandler.error();
+    item->errorMessage = errorHandler.errorMessage();
+    item->errors = errorHandler.getErrors();
+    item->message.reset();
+    item->parsed = ParsedIncidence();
+    ErrorHandler::clearErrors();
+}
+
+class KolabObjectBatchReader::Private
+{
+public:
+    Private()
+    :   mOverrideObjectType(InvalidObject),
+        mDoOverrideVersion(false),
+        mAttachmentPolicy(KolabObjectReader::LoadAttachments)
+    {
+    }
+
+    ~Private()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        qDeleteAll(mItems);
+        mItems.clear();
+    }
+
+    BatchItem *createItem()
+    {
+        BatchItem *item = new BatchItem;
+        item->overrideObjectType = mOverrideObjectType;
+        item->overrideVersion = mOverrideVersion;
+        item->doOverrideVersion = mDoOverrideVersion;
+        item->attachmentPolicy = mAttachmentPolicy;
+        mItems.append(item);
+        return item;
+    }
+
+    QList<BatchItem*> mItems;
+    ObjectType mOverrideObjectType;
+    Version mOverrideVersion;
+    bool mDoOverrideVersion;
+    KolabObjectReader::AttachmentPolicy mAttachmentPolicy;
+};
+//@endcond
+
+KolabObjectBatchReader::KolabObjectBatchReader()
+: d( new KolabObjectBatchReader::Private )
+{
+}
+
+KolabObjectBatchReader::~KolabObjectBatchReader()
+{
+    delete d;
+}
+
+void KolabObjectBatchReader::setObjectType(ObjectType type)
+{
+    d->mOverrideObjectType = type;
+}
+
+void KolabObjectBatchReader::setVersion(Version version)
+{
+    d->mOverrideVersion = version;
+    d->mDoOverrideVersion = true;
+}
+
+void KolabObjectBatchReader::setAttachmentPolicy(KolabObjectReader::AttachmentPolicy policy)
+{
+    d->mAttachmentPolicy = policy;
+}
+
+void KolabObjectBatchReader::readItems()
+{
+    QtConcurrent::blockingMap(d->mItems, parseBatchItem);
+    Q_FOREACH (BatchItem *item, d->mItems) {
+        item->reader.d->mParsedIncidence = &item->parsed;
+        readBatchItem(item);
+        item->reader.d->mParsedIncidence = 0;
+    }
+}
+
+void KolabObjectBatchReader::parseMimeMessages(const QList<KMime::Message::Ptr> &msgs)
+{
+    d->clear();
+    Q_FOREACH (const KMime::Message::Ptr &msg, msgs) {
+        d->createItem()->message = msg;
+    }
+    readItems();
+}
+
+void KolabObjectBatchReader::parseMimeMessages(const QList<QByteArray> &msgs)
+{
+    d->clear();
+    //The charsets KMime uses by default
+    primeCharset("US-ASCII");
+    primeCharset("ISO-8859-1");
+    primeCharset("UTF-8");
+    Q_FOREACH (const QByteArray &msg, msgs) {
+        primeCharsets(msg);
+        d->createItem()->content = msg;
+    }
+    readItems();
+}
+
+int KolabObjectBatchReader::count() const
+{
+    return d->mItems.size();
+}
+
+const KolabObjectReader &KolabObjectBatchReader::reader(int index) const
+{
+    return d->mItems.at(index)->reader;
+}
+
+ErrorHandler::Severity KolabObjectBatchReader::error(int index) const
+{
+    return d->mItems.at(index)->severity;
+}
+
+QString KolabObjectBatchReader::errorMessage(int index) const
+{
+    return d->mItems.at(index)->errorMessage;
+}
+
+QList<ErrorHandler::Err> KolabObjectBatchReader::errors(int index) const
+{
+    return d->mItems.at(index)->errors;
+}
+
+
+/*
+ * Refuses incidences with attachments that reference a mime part which was not loaded (see KolabObjectReader::AttachmentPolicy),
+ * since writing them would write empty attachment parts.
+ */
+static bool hasIncompleteAttachments(const KCalCore::Incidence::Ptr &incidence)
+{
+    Q_FOREACH (const KCalCore::Attachment::Ptr &attachment, incidence->attachments()) {
+        if (attachment->isUri() && attachment->uri().startsWith(QLatin1String("cid:"))) {
+            Error() << "the attachment " << attachment->uri() << " was not loaded, writing it would lose it";
+            return true;
+        }
+    }
+    return false;
+}
+
+//Normalize incidences before serializing them, the mime parts of the attachments are added to @param attachmentParts
+KCalCore::Incidence::Ptr normalizeIncidence(KCalCore::Incidence::Ptr original, QList<KMime::Content*> &attachmentParts)
 {
     KCalCore::Incidence::Ptr i = KCalCore::Incidence::Ptr(original->clone()); //We copy to avoid destructive writing
     Q_FOREACH (KCalCore::Attachment::Ptr attachment, i->attachments()) {
-        attachment->setUri(QString::fromLatin1("cid:")+QString::fromLatin1(KMime::uniqueString() + '@' + "kolab.resource.akonadi")); //Serialize the attachment as attachment with uri, referencing the created mime-part
+        const QByteArray cid = KMime::uniqueString() + '@' + "kolab.resource.akonadi";
+        attachmentParts << Mime::createAttachmentPart(cid, attachment); //Created before setting the uri, which drops the encoded data of the attachment
+        attachment->setUri(QString::fromLatin1("cid:")+QString::fromLatin1(cid)); //Serialize the attachment as attachment with uri, referencing the created mime-part
     }
     return i;
 }
@@ -655,12 +1154,17 @@ KMime::Message::Ptr KolabObjectWriter::writeEvent(const KCalCore::Event::Ptr &i,
         return KMime::Message::Ptr();
     }
     Q_ASSERT(!i.isNull());
+    ErrorHandler::setObjectUid(i->uid());
+    if (hasIncompleteAttachments(i)) {
+        return KMime::Message::Ptr();
+    }
     if (v == KolabV3) {
-        KCalCore::Event::Ptr ic = normalizeIncidence(i).dynamicCast<KCalCore::Event>();
+        QList<KMime::Content*> attachmentParts;
+        KCalCore::Event::Ptr ic = normalizeIncidence(i, attachmentParts).dynamicCast<KCalCore::Event>();
         const Kolab::Event &incidence = Kolab::Conversion::fromKCalCore(*ic);
         const std::string &v3String = Kolab::writeEvent(incidence, std::string(getProductId(productId).toUtf8().constData()));
         ErrorHandler::handleLibkolabxmlErrors();
-        return Mime::createMessage(ic, xCalMimeType(), eventKolabType(), QString::fromUtf8(v3String.c_str()).toUtf8(), true, getProductId(productId));
+        return Mime::createMessage(ic, xCalMimeType(), eventKolabType(), QString::fromUtf8(v3String.c_str()).toUtf8(), getProductId(productId), attachmentParts);
     }
     const QString &xml = KolabV2::Event::eventToXML(i, tz);
     return Mime::createMessage(i, eventKolabType(), eventKolabType(), xml.toUtf8(), false, getProductId(productId));
@@ -674,12 +1178,17 @@ KMime::Message::Ptr KolabObjectWriter::writeTodo(const KCalCore::Todo::Ptr &i, V
         return KMime::Message::Ptr();
     }
     Q_ASSERT(!i.isNull());
+    ErrorHandler::setObjectUid(i->uid());
+    if (hasIncompleteAttachments(i)) {
+        return KMime::Message::Ptr();
+    }
     if (v == KolabV3) {
-        KCalCore::Todo::Ptr ic = normalizeIncidence(i).dynamicCast<KCalCore::Todo>();
+        QList<KMime::Content*> attachmentParts;
+        KCalCore::Todo::Ptr ic = normalizeIncidence(i, attachmentParts).dynamicCast<KCalCore::Todo>();
         const Kolab::Todo &incidence = Kolab::Conversion::fromKCalCore(*ic);
         const std::string &v3String = Kolab::writeTodo(incidence, Conversion::toStdString(getProductId(productId)));
         ErrorHandler::handleLibkolabxmlErrors();
-        return Mime::createMessage(ic, xCalMimeType(), todoKolabType(), Conversion::fromStdString(v3String).toUtf8(), true, getProductId(productId));
+        return Mime::createMessage(ic, xCalMimeType(), todoKolabType(), Conversion::fromStdString(v3String).toUtf8(), getProductId(productId), attachmentParts);
     }
     const QString &xml = KolabV2::Task::taskToXML(i, tz);
     return Mime::createMessage(i, todoKolabType(), todoKolabType(), xml.toUtf8(), false, getProductId(productId));
@@ -693,12 +1202,17 @@ KMime::Message::Ptr KolabObjectWriter::writeJournal(const KCalCore::Journal::Ptr
         return KMime::Message::Ptr();
     }
     Q_ASSERT(!i.isNull());
+    ErrorHandler::setObjectUid(i->uid());
+    if (hasIncompleteAttachments(i)) {
+        return KMime::Message::Ptr();
+    }
     if (v == KolabV3) {
-        KCalCore::Journal::Ptr ic = normalizeIncidence(i).dynamicCast<KCalCore::Journal>();
+        QList<KMime::Content*> attachmentParts;
+        KCalCore::Journal::Ptr ic = normalizeIncidence(i, attachmentParts).dynamicCast<KCalCore::Journal>();
         const Kolab::Journal &incidence = Kolab::Conversion::fromKCalCore(*ic);
         const std::string &v3String = Kolab::writeJournal(incidence, Conversion::toStdString(getProductId(productId)));
         ErrorHandler::handleLibkolabxmlErrors();
-        return  Mime::createMessage(ic, xCalMimeType(), journalKolabType(), Conversion::fromStdString(v3String).toUtf8(), true, getProductId(productId));
+        return  Mime::createMessage(ic, xCalMimeType(), journalKolabType(), Conversion::fromStdString(v3String).toUtf8(), getProductId(productId), attachmentParts);
     }
     const QString &xml = KolabV2::Journal::journalToXML(i, tz);
     return Mime::createMessage(i, journalKolabType(), journalKolabType(), xml.toUtf8(), false, getProductId(productId));
@@ -727,6 +1241,7 @@ KMime::Message::Ptr KolabObjectWriter::writeIncidence(const KCalCore::Incidence:
 KMime::Message::Ptr KolabObjectWriter::writeContact(const KABC::Addressee &addressee, Version v, const QString &productId)
 {
     ErrorHandler::clearErrors();
+    ErrorHandler::setObjectUid(addressee.uid());
     if (v == KolabV3) {
         const Kolab::Contact &contact = Kolab::Conversion::fromKABC(addressee);
         const std::string &v3String = Kolab::writeContact(contact, Conversion::toStdString(getProductId(productId)));
@@ -38,6 +38,7 @@
 #include <kmime/kmime_message.h>
 
 #include "kolabdefinitions.h"
+#include "errorhandler.h"
 
 namespace Kolab {
 
@@ -58,6 +59,24 @@ struct KOLAB_EXPORT RelationMember {
 KOLAB_EXPORT RelationMember parseMemberUrl(const QString &url);
 KOLAB_EXPORT QString generateMemberUrl(const RelationMember &url);
 
+struct KOLAB_EXPORT KolabHeaders {
+    KolabHeaders(): type(InvalidObject), version(KolabV2) {}
+    ObjectType type;
+    Version version;
+    QString uid;
+};
+
+/**
+ * Reads the object type, version and uid from the header block of a raw Kolab Mime message.
+ *
+ * Only the headers are scanned and no KMime objects are constructed, so this can be used to decide
+ * whether a message needs to be fetched or parsed at all (i.e. on the result of an IMAP BODY.PEEK[HEADER] fetch).
+ * The data doesn't need to contain the message body.
+ *
+ * Unlike KolabObjectReader, the type is not autodetected if the X-Kolab-Type header is missing.
+ */
+KOLAB_EXPORT KolabHeaders sniffKolabHeaders(const char *data, std::size_t size);
+
 /**
  * Class to read Kolab Mime files
  * 
@@ -68,6 +87,16 @@ KOLAB_EXPORT QString generateMemberUrl(const RelationMember &url);
  */
 class KOLAB_EXPORT KolabObjectReader {
 public:
+    /**
+     * Objects read with ReferenceAttachments or SkipAttachments must not be written back, as this would write empty attachment parts.
+     * KolabObjectWriter therefore refuses incidences with attachments that still reference a mime part by cid: uri.
+     */
+    enum AttachmentPolicy {
+        LoadAttachments, //The attachments are decoded and set on the incidence (default)
+        ReferenceAttachments, //The attachments keep the cid: uri of the mime part and are only decoded by getAttachmentData(). Not available for v2, where attachments are loaded.
+        SkipAttachments //The attachments keep the cid: uri of the mime part, without looking up the part. Not available for v2, where attachments are loaded.
+    };
+
     KolabObjectReader();
     explicit KolabObjectReader(const KMime::Message::Ptr &msg);
     ~KolabObjectReader();
@@ -83,6 +112,14 @@ public:
      * Set to override the autodetected version, before parsing the message.
      */
     void setVersion(Version);
+
+    /**
+     * Set how attachments are handled, before parsing the message.
+     *
+     * Skipping or referencing the attachments avoids decoding them,
+     * if only the metadata of an incidence is required (i.e. for indexing or freebusy).
+     */
+    void setAttachmentPolicy(AttachmentPolicy);
     
     /**
      * Returns the Object type of the parsed kolab object.
@@ -108,6 +145,13 @@ public:
     KMime::Message::Ptr getNote() const;
     QStringList getDictionary(QString &lang) const;
     Freebusy getFreebusy() const;
+
+    /**
+     * Returns the decoded content of an attachment, which was referenced using ReferenceAttachments.
+     *
+     * @param uri the cid: uri of the attachment
+     */
+    QByteArray getAttachmentData(const QString &uri) const;
 #ifdef HAVE_TAG_H
     bool isTag() const;
     Akonadi::Tag getTag() const;
@@ -122,6 +166,77 @@ private:
     //@cond PRIVATE
     KolabObjectReader(const KolabObjectReader &other);
     KolabObjectReader &operator=(const KolabObjectReader &rhs);
+    friend class KolabObjectBatchReader;
+    class Private;
+    Private *const d;
+    //@endcond
+};
+
+/**
+ * Class to read a batch of Kolab Mime files, partially concurrently
+ *
+ * Using the threads of QThreadPool::globalInstance(), the raw messages are parsed by KMime
+ * and the xml of v3 events, todos and journals is parsed by libkolabxml concurrently.
+ * The objects are then converted by a KolabObjectReader per message in the calling thread,
+ * because the conversion relies on KSystemTimeZones and KCalCore, which are not thread-safe.
+ * All other object types and v2 objects are read completely in the calling thread.
+ * The errors of each message are available individually after parsing.
+ *
+ * The results are available until the next call to parseMimeMessages().
+ */
+class KOLAB_EXPORT KolabObjectBatchReader {
+public:
+    KolabObjectBatchReader();
+    ~KolabObjectBatchReader();
+
+    /**
+     * Parses all messages and blocks until all of them are processed.
+     */
+    void parseMimeMessages(const QList<KMime::Message::Ptr> &msgs);
+    /**
+     * Same as above but for unparsed messages, the KMime parsing is done concurrently as well.
+     */
+    void parseMimeMessages(const QList<QByteArray> &msgs);
+
+    /**
+     * Set to override the autodetected object type, before parsing the messages.
+     */
+    void setObjectType(ObjectType);
+
+    /**
+     * Set to override the autodetected version, before parsing the messages.
+     */
+    void setVersion(Version);
+
+    /**
+     * Set how attachments are handled, before parsing the messages.
+     */
+    void setAttachmentPolicy(KolabObjectReader::AttachmentPolicy);
+
+    /**
+     * Returns the number of parsed messages.
+     */
+    int count() const;
+
+    /**
+     * Returns the reader holding the result for the message at @param index.
+     *
+     * Use KolabObjectReader::getType() to determine the correct getter to call.
+     */
+    const KolabObjectReader &reader(int index) const;
+
+    /**
+     * Returns the worst error which occured while parsing the message at @param index.
+     */
+    ErrorHandler::Severity error(int index) const;
+    QString errorMessage(int index) const;
+    QList<ErrorHandler::Err> errors(int index) const;
+
+private:
+    //@cond PRIVATE
+    KolabObjectBatchReader(const KolabObjectBatchReader &other);
+    KolabObjectBatchReader &operator=(const KolabObjectBatchReader &rhs);
+    void readItems();
     class Private;
     Private *const d;
     //@endcond
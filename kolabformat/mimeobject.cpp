@@ -19,12 +19,118 @@
 #include "conversion/kcalconversion.h"
 #include "conversion/kolabconversion.h"
 #include "conversion/kabcconversion.h"
+#include "conversion/commonconversion.h"
 #include "kolabformat/kolabobject.h"
+#include "kolabformat/errorhandler.h"
+#include "kolabformat/v3helpers.h"
+#include "mime/mimeutils.h"
 #include <QString>
 
 namespace Kolab
 {
 
+/*
+ * The input is not copied, the message must therefore not outlive the buffer.
+ * This is fine since the parsed message is only used within the read functions,
+ * and KMime copies the individual parts while parsing.
+ */
+static KMime::Message::Ptr parseMessage(const char *data, std::size_t size)
+{
+    KMime::Message::Ptr msg(new KMime::Message);
+    msg->setContent(QByteArray::fromRawData(data, size));
+    msg->parse();
+    return msg;
+}
+
+static bool isKolabV3(const KMime::Message::Ptr &msg)
+{
+    KMime::Headers::Base *xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER);
+    if (!xKolabVersion) {
+        //For backwards compatibility to development versions, can be removed in future versions
+        xKolabVersion = msg->getHeaderByType(X_KOLAB_MIME_VERSION_HEADER_COMPAT);
+    }
+    return xKolabVersion && xKolabVersion->asUnicodeString() != KOLAB_VERSION_V2;
+}
+
+/*
+ * Reads the libkolabxml container directly from the kolab part,
+ * without the detour over the KCalCore/KABC representation which is used by KolabObjectReader.
+ */
+template <typename T>
+static T readKolabV3(const KMime::Message::Ptr &msg, const QByteArray &mimeType, T (*readFunction)(const std::string &, bool))
+{
+    ErrorHandler::clearErrors();
+    if (msg->contents().isEmpty()) {
+        Critical() << "message has no contents (we likely failed to parse it correctly)";
+        return T();
+    }
+    //The subject contains the uid of the object
+    ErrorHandler::setObjectUid(msg->subject()->asUnicodeString());
+    KMime::Content * const xmlContent = Mime::findContentByType(msg, mimeType);
+    if (!xmlContent) {
+        Critical() << "no " << mimeType << " part found";
+        return T();
+    }
+    const QByteArray &content = xmlContent->decodedContent();
+    const T object = readFunction(std::string(content.data(), content.size()), false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return object;
+}
+
+template <typename T>
+static T readIncidenceV3(const KMime::Message::Ptr &msg, T (*readFunction)(const std::string &, bool))
+{
+    T incidence = readKolabV3<T>(msg, MIME_TYPE_XCAL, readFunction);
+    incidence.setAttachments(Mime::getAttachmentsById(incidence.attachments(), Mime::PartIndex(msg)));
+    return incidence;
+}
+
+/*
+ * Writes the incidence directly to xml, without the detour over KCalCore which is used by KolabObjectWriter.
+ *
+ * Binary attachments are serialized as separate mime parts and referenced by a cid uri, attachments by url are kept as is.
+ */
+template <typename T>
+static std::string writeIncidenceV3(const T &original, const ContactReference &organizer, const QString &xKolabType, std::string (*writeFunction)(const T &, const std::string &), const std::string &productId)
+{
+    ErrorHandler::clearErrors();
+    ErrorHandler::setObjectUid(Conversion::fromStdString(original.uid()));
+    const QString prodid = getProductId(Conversion::fromStdString(productId));
+
+    T incidence = original; //We copy to avoid destructive writing
+    QList<KMime::Content*> attachmentParts;
+    std::vector<Kolab::Attachment> attachments;
+    foreach (const Kolab::Attachment &attachment, original.attachments()) {
+        if (!attachment.uri().empty()) {
+            attachments.push_back(attachment);
+            continue;
+        }
+        const QByteArray cid = KMime::uniqueString() + '@' + "kolab.resource.akonadi";
+        const QString label = Conversion::fromStdString(attachment.label());
+        attachmentParts << Mime::createAttachmentPart(cid, Conversion::fromStdString(attachment.mimetype()), label, QByteArray(attachment.data().c_str(), attachment.data().size()));
+        Kolab::Attachment a;
+        a.setUri(std::string("cid:") + cid.constData(), attachment.mimetype());
+        a.setLabel(attachment.label());
+        attachments.push_back(a);
+    }
+    incidence.setAttachments(attachments);
+
+    const std::string &v3String = writeFunction(incidence, Conversion::toStdString(prodid));
+    ErrorHandler::handleLibkolabxmlErrors();
+
+    KMime::Message::Ptr message = Mime::createMessage(xKolabType, true, prodid);
+    if (!organizer.email().empty()) {
+        message->from()->addAddress(QByteArray(organizer.email().c_str()), Conversion::fromStdString(organizer.name()));
+    }
+    message->subject()->fromUnicodeString(Conversion::fromStdString(Kolab::getSerializedUID()), "utf-8");
+    message->addContent(Mime::createMainPart(MIME_TYPE_XCAL, QByteArray(v3String.c_str(), v3String.size())));
+    foreach (KMime::Content *part, attachmentParts) {
+        message->addContent(part);
+    }
+    message->assemble();
+    return message->encodedContent().data();
+}
+
 MIMEObject::MIMEObject()
 {
 
@@ -32,6 +138,9 @@ MIMEObject::MIMEObject()
 
 std::string MIMEObject::writeEvent(const Event &event, Version version, const std::string &productId)
 {
+    if (version == KolabV3) {
+        return writeIncidenceV3(event, event.organizer(), KOLAB_TYPE_EVENT, &Kolab::writeEvent, productId);
+    }
 
     KCalCore::Event::Ptr KEvent = Conversion::toKCalCore(event);
 
@@ -43,17 +152,28 @@ std::string MIMEObject::writeEvent(const Event &event, Version version, const st
 
 Event MIMEObject::readEvent(const std::string &s)
 {
+    return readEvent(s.data(), s.size());
+}
+
+Event MIMEObject::readEvent(const char *data, std::size_t size)
+{
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readIncidenceV3<Event>(msg, &Kolab::readEvent);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KCalCore::Event::Ptr event = KolabObjectReader(msg).getEvent();
-    
+    if (!event) {
+        return Event();
+    }
     return Conversion::fromKCalCore(*event); 
 }
 
 std::string MIMEObject::writeTodo(const Todo &todo, Version version, const std::string &productId){
+    if (version == KolabV3) {
+        return writeIncidenceV3(todo, todo.organizer(), KOLAB_TYPE_TASK, &Kolab::writeTodo, productId);
+    }
+
     KCalCore::Todo::Ptr kTodo = Conversion::toKCalCore(todo);
 
     KMime::Message::Ptr msg = KolabObjectWriter().writeTodo(kTodo, version, QString::fromStdString(productId));
@@ -63,19 +183,30 @@ std::string MIMEObject::writeTodo(const Todo &todo, Version version, const std::
 }
 
 
-Todo MIMEObject::readTodo(const std::string &s){
+Todo MIMEObject::readTodo(const std::string &s)
+{
+    return readTodo(s.data(), s.size());
+}
+
+Todo MIMEObject::readTodo(const char *data, std::size_t size){
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readIncidenceV3<Todo>(msg, &Kolab::readTodo);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KCalCore::Todo::Ptr todo = KolabObjectReader(msg).getTodo();
-    
+    if (!todo) {
+        return Todo();
+    }
     return Conversion::fromKCalCore(*todo);
 }
 
 
 std::string MIMEObject::writeJournal(const Journal &journal, Version version, const std::string &productId){
+    if (version == KolabV3) {
+        return writeIncidenceV3(journal, ContactReference(), KOLAB_TYPE_JOURNAL, &Kolab::writeJournal, productId);
+    }
+
     KCalCore::Journal::Ptr kJournal = Conversion::toKCalCore(journal);
 
     KMime::Message::Ptr msg = KolabObjectWriter().writeJournal(kJournal, version, QString::fromStdString(productId));
@@ -85,18 +216,35 @@ std::string MIMEObject::writeJournal(const Journal &journal, Version version, co
 }
 
 
-Journal MIMEObject::readJournal(const std::string &s){
+Journal MIMEObject::readJournal(const std::string &s)
+{
+    return readJournal(s.data(), s.size());
+}
+
+Journal MIMEObject::readJournal(const char *data, std::size_t size){
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readIncidenceV3<Journal>(msg, &Kolab::readJournal);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KCalCore::Journal::Ptr journal = KolabObjectReader(msg).getJournal();
-    
+    if (!journal) {
+        return Journal();
+    }
     return Conversion::fromKCalCore(*journal);
 }
 
 std::string MIMEObject::writeNote(const Note &note, Version version, const std::string &productId){
+    if (version == KolabV3) {
+        ErrorHandler::clearErrors();
+        ErrorHandler::setObjectUid(Conversion::fromStdString(note.uid()));
+        const QString prodid = getProductId(Conversion::fromStdString(productId));
+        const std::string &v3String = Kolab::writeNote(note, Conversion::toStdString(prodid));
+        ErrorHandler::handleLibkolabxmlErrors();
+        KMime::Message::Ptr msg = Mime::createMessage(Conversion::fromStdString(Kolab::getSerializedUID()), MIME_TYPE_KOLAB, KOLAB_TYPE_NOTE, QByteArray(v3String.c_str(), v3String.size()), true, prodid);
+        return msg->encodedContent().data();
+    }
+
     KMime::Message::Ptr kNote = Conversion::toNote(note);
 
     KMime::Message::Ptr msg = KolabObjectWriter().writeNote(kNote, version, QString::fromStdString(productId));
@@ -106,18 +254,46 @@ std::string MIMEObject::writeNote(const Note &note, Version version, const std::
 }
 
 
-Note MIMEObject::readNote(const std::string &s){
+Note MIMEObject::readNote(const std::string &s)
+{
+    return readNote(s.data(), s.size());
+}
+
+Note MIMEObject::readNote(const char *data, std::size_t size){
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readKolabV3<Note>(msg, MIME_TYPE_KOLAB, &Kolab::readNote);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KMime::Message::Ptr note = KolabObjectReader(msg).getNote();
-    
+    if (!note) {
+        return Note();
+    }
     return Conversion::fromNote(note);
 }
 
 std::string MIMEObject::writeContact(const Contact &contact, Version version, const std::string &productId){
+    if (version == KolabV3) {
+        ErrorHandler::clearErrors();
+        ErrorHandler::setObjectUid(Conversion::fromStdString(contact.uid()));
+        const QString prodid = getProductId(Conversion::fromStdString(productId));
+        const std::string &v3String = Kolab::writeContact(contact, Conversion::toStdString(prodid));
+        ErrorHandler::handleLibkolabxmlErrors();
+
+        KMime::Message::Ptr msg = Mime::createMessage(KOLAB_TYPE_CONTACT, true, prodid);
+        msg->subject()->fromUnicodeString(Conversion::fromStdString(Kolab::getSerializedUID()), "utf-8");
+        const std::vector<Kolab::Email> &emails = contact.emailAddresses();
+        if (!emails.empty()) {
+            //Same as KABC::Addressee::fullEmail() used by KolabObjectWriter
+            const int preferred = contact.emailAddressPreferredIndex();
+            const Kolab::Email &email = (preferred >= 0 && preferred < static_cast<int>(emails.size())) ? emails.at(preferred) : emails.front();
+            msg->from()->addAddress(QByteArray(email.address().c_str()), Conversion::fromStdString(contact.name()));
+        }
+        msg->addContent(Mime::createMainPart(MIME_TYPE_XCARD, QByteArray(v3String.c_str(), v3String.size())));
+        msg->assemble();
+        return msg->encodedContent().data();
+    }
+
     KABC::Addressee kContact = Conversion::toKABC(contact);
 
     KMime::Message::Ptr msg = KolabObjectWriter().writeContact(kContact, version, QString::fromStdString(productId));
@@ -127,18 +303,33 @@ std::string MIMEObject::writeContact(const Contact &contact, Version version, co
 }
 
 
-Contact MIMEObject::readContact(const std::string &s){
+Contact MIMEObject::readContact(const std::string &s)
+{
+    return readContact(s.data(), s.size());
+}
+
+Contact MIMEObject::readContact(const char *data, std::size_t size){
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readKolabV3<Contact>(msg, MIME_TYPE_XCARD, &Kolab::readContact);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KABC::Addressee contact = KolabObjectReader(msg).getContact();
     
     return Conversion::fromKABC(contact);
 }
 
 std::string MIMEObject::writeDistlist(const DistList &distlist, Version version, const std::string &productId){
+    if (version == KolabV3) {
+        ErrorHandler::clearErrors();
+        ErrorHandler::setObjectUid(Conversion::fromStdString(distlist.uid()));
+        const QString prodid = getProductId(Conversion::fromStdString(productId));
+        const std::string &v3String = Kolab::writeDistlist(distlist, Conversion::toStdString(prodid));
+        ErrorHandler::handleLibkolabxmlErrors();
+        KMime::Message::Ptr msg = Mime::createMessage(Conversion::fromStdString(Kolab::getSerializedUID()), MIME_TYPE_XCARD, KOLAB_TYPE_DISTLIST, QByteArray(v3String.c_str(), v3String.size()), true, prodid);
+        return msg->encodedContent().data();
+    }
+
     KABC::ContactGroup kDistlist = Conversion::toKABC(distlist);
 
     KMime::Message::Ptr msg = KolabObjectWriter().writeDistlist(kDistlist, version, QString::fromStdString(productId));
@@ -148,15 +339,19 @@ std::string MIMEObject::writeDistlist(const DistList &distlist, Version version,
 }
 
 
-DistList MIMEObject::readDistlist(const std::string &s){
+DistList MIMEObject::readDistlist(const std::string &s)
+{
+    return readDistlist(s.data(), s.size());
+}
+
+DistList MIMEObject::readDistlist(const char *data, std::size_t size){
+    const KMime::Message::Ptr msg = parseMessage(data, size);
+    if (isKolabV3(msg)) {
+        return readKolabV3<DistList>(msg, MIME_TYPE_XCARD, &Kolab::readDistlist);
+    }
 
-    KMime::Message::Ptr msg(new KMime::Message);
-    msg->setContent(QByteArray(s.c_str()));
-    msg->parse();
-    
     KABC::ContactGroup distlist = KolabObjectReader(msg).getDistlist();
     
     return Conversion::fromKABC(distlist);
 }
 }
-
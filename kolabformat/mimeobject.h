@@ -32,6 +32,13 @@
 namespace Kolab
 {
 
+/**
+ * Reads and writes kolab objects from/to mime messages
+ *
+ * The read functions taking a pointer and a size don't copy the input,
+ * which avoids to hold multiple copies of large messages (i.e. with attachments) in memory.
+ * Use them with QByteArray::constData() and QByteArray::size() to read a QByteArray without copying it.
+ */
 class KOLAB_EXPORT MIMEObject
 {
 public:
@@ -39,21 +46,39 @@ public:
 
     std::string writeEvent(const Kolab::Event  &event, Version version, const std::string &productId = std::string());
     Kolab::Event readEvent(const std::string &s);
+#ifndef SWIG
+    Kolab::Event readEvent(const char *data, std::size_t size);
+#endif
 
     std::string writeTodo(const Kolab::Todo &todo, Version version, const std::string &productId = std::string());
     Kolab::Todo readTodo(const std::string &s);
+#ifndef SWIG
+    Kolab::Todo readTodo(const char *data, std::size_t size);
+#endif
 
     std::string writeJournal(const Kolab::Journal &journal, Version version, const std::string &productId = std::string());
     Kolab::Journal readJournal(const std::string &s);
+#ifndef SWIG
+    Kolab::Journal readJournal(const char *data, std::size_t size);
+#endif
 
     std::string writeNote(const Kolab::Note &note, Version version, const std::string &productId = std::string());
     Kolab::Note readNote(const std::string &s);
+#ifndef SWIG
+    Kolab::Note readNote(const char *data, std::size_t size);
+#endif
 
     std::string writeContact(const Kolab::Contact &contact, Version version, const std::string &productId = std::string());
     Kolab::Contact readContact(const std::string &s);
+#ifndef SWIG
+    Kolab::Contact readContact(const char *data, std::size_t size);
+#endif
 
     std::string writeDistlist(const Kolab::DistList &distlist, Version version, const std::string &productId = std::string());
     Kolab::DistList readDistlist(const std::string &s);
+#ifndef SWIG
+    Kolab::DistList readDistlist(const char *data, std::size_t size);
+#endif
 
 };
 }
@@ -62,7 +62,8 @@ static KCalPtr fromXML(const QByteArray &xmlData, QStringList &attachments)
 template <typename IncidencePtr, typename Converter>
 static inline IncidencePtr incidenceFromKolabImpl( const KMime::Message::Ptr &data, const QByteArray &mimetype, const QString &timezoneId )
 {
-    KMime::Content *xmlContent = Mime::findContentByType( data, mimetype );
+    const Mime::PartIndex parts(data);
+    KMime::Content *xmlContent = parts.findByType( mimetype );
     if ( !xmlContent ) {
         Critical() << "couldn't find part";
         return IncidencePtr();
@@ -71,7 +72,7 @@ static inline IncidencePtr incidenceFromKolabImpl( const KMime::Message::Ptr &da
     
     QStringList attachments;
     IncidencePtr ptr = fromXML<IncidencePtr, Converter>(xmlData, attachments); //TODO do we care about timezone?
-    Mime::getAttachments(ptr, attachments, data);
+    Mime::getAttachments(ptr, attachments, parts);
     
     return ptr;
 }
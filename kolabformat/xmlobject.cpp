@@ -22,6 +22,7 @@
 #include "conversion/kolabconversion.h"
 #include "conversion/commonconversion.h"
 #include "conversion/kabcconversion.h"
+#include "errorhandler.h"
 #include <QUuid>
 
 namespace Kolab {
@@ -49,6 +50,7 @@ std::vector< std::string > XMLObject::getAttachments() const
 
 std::string XMLObject::writeEvent(const Event &event, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         const KCalCore::Event::Ptr i = Conversion::toKCalCore(event);
@@ -66,14 +68,16 @@ std::string XMLObject::writeEvent(const Event &event, Version version, const std
     }
     const std::string result = Kolab::writeEvent(event, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Event XMLObject::readEvent(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
         QStringList attachments;
-        const KCalCore::Event::Ptr event = Kolab::fromXML<KCalCore::Event::Ptr, KolabV2::Event>(QString::fromUtf8(s.c_str()).toUtf8(), attachments);
+        const KCalCore::Event::Ptr event = Kolab::fromXML<KCalCore::Event::Ptr, KolabV2::Event>(QByteArray::fromRawData(s.data(), s.size()), attachments);
         if (!event || Kolab::ErrorHandler::errorOccured()) {
             Critical() << "failed to read xml";
             return Event();
@@ -84,11 +88,14 @@ Event XMLObject::readEvent(const std::string& s, Version version)
         }
         return Conversion::fromKCalCore(*event);
     }
-    return Kolab::readEvent(s, false);
+    const Event result = Kolab::readEvent(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeTodo(const Todo &event, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         const KCalCore::Todo::Ptr i = Conversion::toKCalCore(event);
@@ -106,14 +113,16 @@ std::string XMLObject::writeTodo(const Todo &event, Version version, const std::
     }
     const std::string result = Kolab::writeTodo(event, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Todo XMLObject::readTodo(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
         QStringList attachments;
-        const KCalCore::Todo::Ptr event = Kolab::fromXML<KCalCore::Todo::Ptr, KolabV2::Task>(QString::fromUtf8(s.c_str()).toUtf8(), attachments);
+        const KCalCore::Todo::Ptr event = Kolab::fromXML<KCalCore::Todo::Ptr, KolabV2::Task>(QByteArray::fromRawData(s.data(), s.size()), attachments);
         if (!event || Kolab::ErrorHandler::errorOccured()) {
             Error() << "failed to read xml";
             return Todo();
@@ -124,11 +133,14 @@ Todo XMLObject::readTodo(const std::string& s, Version version)
         }
         return Conversion::fromKCalCore(*event);
     }
-    return Kolab::readTodo(s, false);
+    const Todo result = Kolab::readTodo(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeJournal(const Journal &event, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         const KCalCore::Journal::Ptr i = Conversion::toKCalCore(event);
@@ -146,14 +158,16 @@ std::string XMLObject::writeJournal(const Journal &event, Version version, const
     }
     const std::string result = Kolab::writeJournal(event, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Journal XMLObject::readJournal(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
         QStringList attachments;
-        const KCalCore::Journal::Ptr event = Kolab::fromXML<KCalCore::Journal::Ptr, KolabV2::Journal>(QString::fromUtf8(s.c_str()).toUtf8(), attachments);
+        const KCalCore::Journal::Ptr event = Kolab::fromXML<KCalCore::Journal::Ptr, KolabV2::Journal>(QByteArray::fromRawData(s.data(), s.size()), attachments);
         if (!event || Kolab::ErrorHandler::errorOccured()) {
             Critical() << "failed to read xml";
             return Journal();
@@ -164,11 +178,14 @@ Journal XMLObject::readJournal(const std::string& s, Version version)
         }
         return Conversion::fromKCalCore(*event);
     }
-    return Kolab::readJournal(s, false);
+    const Journal result = Kolab::readJournal(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeFreebusy(const Freebusy &event, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version != KolabV3) {
         Critical() << "only v3 implementation available";
@@ -176,16 +193,20 @@ std::string XMLObject::writeFreebusy(const Freebusy &event, Version version, con
     }
     const std::string result = Kolab::writeFreebusy(event, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Freebusy XMLObject::readFreebusy(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version != KolabV3) {
         Critical() << "only v3 implementation available";
         return Freebusy();
     }
-    return Kolab::readFreebusy(s, false);
+    const Freebusy result = Kolab::readFreebusy(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::logoAttachmentName() const
@@ -205,8 +226,9 @@ std::string XMLObject::soundAttachmentName() const
 
 Contact XMLObject::readContact(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {        
-        const QByteArray xmlData(s.c_str(), s.size());
+        const QByteArray xmlData = QByteArray::fromRawData(s.data(), s.size());
         QString pictureAttachmentName;
         QString logoAttachmentName;
         QString soundAttachmentName;
@@ -216,11 +238,14 @@ Contact XMLObject::readContact(const std::string& s, Version version)
         mSoundAttachmentName = Conversion::toStdString(soundAttachmentName);
         return Conversion::fromKABC(addressee);
     }
-    return Kolab::readContact(s, false);
+    const Contact result = Kolab::readContact(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeContact(const Contact &contact, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         //FIXME attachment names are hardcoded for now
@@ -234,21 +259,26 @@ std::string XMLObject::writeContact(const Contact &contact, Version version, con
     }
     const std::string result = Kolab::writeContact(contact, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 DistList XMLObject::readDistlist(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {        
-        const QByteArray xmlData(s.c_str(), s.size());
+        const QByteArray xmlData = QByteArray::fromRawData(s.data(), s.size());
         const KABC::ContactGroup contactGroup = contactGroupFromKolab(xmlData);
         return Conversion::fromKABC(contactGroup);
     }
-    return Kolab::readDistlist(s, false);
+    const DistList result = Kolab::readDistlist(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeDistlist(const DistList &distlist, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         KABC::ContactGroup contactGroup = Conversion::toKABC(distlist);
@@ -261,24 +291,29 @@ std::string XMLObject::writeDistlist(const DistList &distlist, Version version,
     }
     const std::string result = Kolab::writeDistlist(distlist, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Note XMLObject::readNote(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
-        const KMime::Message::Ptr msg = noteFromKolab(QByteArray(s.c_str(), s.length()), KDateTime());
+        const KMime::Message::Ptr msg = noteFromKolab(QByteArray::fromRawData(s.data(), s.size()), KDateTime());
         if (!msg || Kolab::ErrorHandler::errorOccured()) {
             Critical() << "failed to read xml";
             return Note();
         }
         return Conversion::fromNote(msg);
     }
-    return Kolab::readNote(s, false);
+    const Note result = Kolab::readNote(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeNote(const Note &note, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version == KolabV2) {
         Note noteWithUID = note;
@@ -292,14 +327,16 @@ std::string XMLObject::writeNote(const Note &note, Version version, const std::s
     }
     const std::string result = Kolab::writeNote(note, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 Configuration XMLObject::readConfiguration(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
         QString lang;
-        const QStringList dict = readLegacyDictionaryConfiguration(QByteArray(s.c_str(), s.length()), lang);
+        const QStringList dict = readLegacyDictionaryConfiguration(QByteArray::fromRawData(s.data(), s.size()), lang);
         if (lang.isEmpty()) {
             Critical() << "not a dictionary or not a v2 configuration object";
             return Kolab::Configuration();
@@ -312,11 +349,14 @@ Configuration XMLObject::readConfiguration(const std::string& s, Version version
         dictionary.setEntries(entries);
         return Configuration(dictionary);
     }
-    return Kolab::readConfiguration(s, false);
+    const Configuration result = Kolab::readConfiguration(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeConfiguration(const Configuration &configuration, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version != KolabV3) {
         Critical() << "only v3 implementation available";
@@ -324,20 +364,25 @@ std::string XMLObject::writeConfiguration(const Configuration &configuration, Ve
     }
     const std::string result = Kolab::writeConfiguration(configuration, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
 File XMLObject::readFile(const std::string& s, Version version)
 {
+    ErrorHandler::clearErrors();
     if (version == KolabV2) {
         Critical() << "only v3 implementation available";
         return File();
     }
-    return Kolab::readFile(s, false);
+    const File result = Kolab::readFile(s, false);
+    ErrorHandler::handleLibkolabxmlErrors();
+    return result;
 }
 
 std::string XMLObject::writeFile(const File &file, Version version, const std::string& productId)
 {
+    ErrorHandler::clearErrors();
     mWrittenUID.clear();
     if (version != KolabV3) {
         Critical() << "only v3 implementation available";
@@ -345,6 +390,7 @@ std::string XMLObject::writeFile(const File &file, Version version, const std::s
     }
     const std::string result = Kolab::writeFile(file, productId);
     mWrittenUID = Kolab::getSerializedUID();
+    ErrorHandler::handleLibkolabxmlErrors();
     return result;
 }
 
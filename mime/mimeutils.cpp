@@ -23,6 +23,7 @@
 #include <kabc/addressee.h>
 #include "kolabformat/kolabdefinitions.h"
 #include "kolabformat/errorhandler.h"
+#include "conversion/commonconversion.h"
 #include "libkolab-version.h"
 
 namespace Kolab {
@@ -75,6 +76,59 @@ KMime::Content* findContentById(const KMime::Message::Ptr &data, const QByteArra
     return 0;
 }
 
+PartIndex::PartIndex(const KMime::Message::Ptr &data)
+{
+    Q_FOREACH(KMime::Content *c, data->contents()) {
+        //Only the first part is indexed for each key, to return the same part as a linear search
+        const QByteArray type = c->contentType()->mimeType();
+        if (!mByType.contains(type)) {
+            mByType.insert(type, c);
+        }
+        const QString name = c->contentType()->name();
+        if (!mByName.contains(name)) {
+            mByName.insert(name, c);
+        }
+        if (KMime::Headers::ContentID *contentId = c->contentID(false)) {
+            const QByteArray id = contentId->identifier();
+            if (!id.isEmpty() && !mById.contains(id)) {
+                mById.insert(id, c);
+            }
+        }
+    }
+}
+
+KMime::Content* PartIndex::findByType(const QByteArray &type) const
+{
+    if (type.isEmpty()) {
+        Error() << "Empty type";
+        return 0;
+    }
+    return mByType.value(type);
+}
+
+KMime::Content* PartIndex::findByName(const QString &name, QByteArray &type) const
+{
+    KMime::Content *c = mByName.value(name);
+    if (c) {
+        type = c->contentType()->mimeType();
+    }
+    return c;
+}
+
+KMime::Content* PartIndex::findById(const QByteArray &id, QByteArray &type, QString &name) const
+{
+    if (id.isEmpty()) {
+        Error() << "looking for empty cid";
+        return 0;
+    }
+    KMime::Content *c = mById.value(id);
+    if (c) {
+        type = c->contentType()->mimeType();
+        name = c->contentType()->name();
+    }
+    return c;
+}
+
 QList<QByteArray> getContentMimeTypeList(const KMime::Message::Ptr& data)
 {
     QList<QByteArray> typeList;
@@ -115,13 +169,36 @@ KMime::Message::Ptr createMessage(const KCalCore::Incidence::Ptr &incidencePtr,
             //onyl by url, skip
             continue;
         }
-        message->addContent( createAttachmentPart(fromCid(attachment->uri()).toLatin1(), attachment->mimeType(), attachment->label(), attachment->decodedData() ) );
+        message->addContent( createAttachmentPart(fromCid(attachment->uri()).toLatin1(), attachment) );
     }
     
     message->assemble();
     return message;
 }
 
+KMime::Message::Ptr createMessage(const KCalCore::Incidence::Ptr &incidencePtr, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, const QString &productId, const QList<KMime::Content*> &attachmentParts)
+{
+    KMime::Message::Ptr message = createMessage( xKolabType, true, productId );
+    if (!incidencePtr) {
+        Error() << "invalid incidence passed  in";
+        qDeleteAll(attachmentParts);
+        message->assemble();
+        return message;
+    }
+    if ( incidencePtr->organizer() && !incidencePtr->organizer()->email().isEmpty()) {
+        message->from()->addAddress( incidencePtr->organizer()->email().toUtf8(), incidencePtr->organizer()->name() );
+    }
+    message->subject()->fromUnicodeString( incidencePtr->uid(), "utf-8" );
+
+    message->addContent( createMainPart( mimetype, xml ) );
+    Q_FOREACH (KMime::Content *part, attachmentParts) {
+        message->addContent( part );
+    }
+
+    message->assemble();
+    return message;
+}
+
 KMime::Message::Ptr createMessage(const KABC::Addressee &contact, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, bool v3, const QString &prodid)
 {
     KMime::Message::Ptr message = Mime::createMessage( xKolabType, v3, prodid );
@@ -244,7 +321,73 @@ KMime::Content* createAttachmentPart(const QByteArray& cid, const QString& mimeT
     return content;
 }
 
-void getAttachments(KCalCore::Incidence::Ptr incidence, const QStringList &attachments, const KMime::Message::Ptr &mimeData)
+/*
+ * Wraps base64 data into lines of 76 characters, as required for mime parts.
+ */
+static QByteArray wrapBase64(const QByteArray &base64)
+{
+    const int lineLength = 76;
+    QByteArray result;
+    result.reserve(base64.size() + base64.size() / lineLength + 1);
+    for (int i = 0; i < base64.size(); i += lineLength) {
+        result.append(base64.constData() + i, qMin(lineLength, base64.size() - i));
+        result.append('\n');
+    }
+    return result;
+}
+
+KMime::Content* createAttachmentPart(const QByteArray& cid, const KCalCore::Attachment::Ptr &attachment)
+{
+    if (!attachment->isBinary()) {
+        return createAttachmentPart(cid, attachment->mimeType(), attachment->label(), attachment->decodedData());
+    }
+    //The attachment already holds the base64 encoded data, so it is used as encoded body instead of decoding it for KMime to encode it again
+    KMime::Content* content = createAttachmentPart(cid, attachment->mimeType(), attachment->label(), QByteArray());
+    content->setBody( wrapBase64(attachment->data()) );
+    content->contentTransferEncoding()->setDecoded( false );
+    return content;
+}
+
+static bool isWhitespace(char c)
+{
+    return c == '\r' || c == '\n' || c == ' ' || c == '\t';
+}
+
+/*
+ * Returns the base64 representation of the content, which is what KCalCore::Attachment stores.
+ *
+ * Encoded base64 parts are passed through without decoding and encoding them again,
+ * only the line breaks are removed (if there are none, the body is shared with the part).
+ * Parts which were not parsed from an encoded message hold the decoded body.
+ */
+static QByteArray toBase64(KMime::Content *content)
+{
+    if (content->contentTransferEncoding()->decoded()) {
+        return content->body().toBase64();
+    }
+    if (content->contentTransferEncoding()->encoding() != KMime::Headers::CEbase64) {
+        return content->decodedContent().toBase64();
+    }
+    const QByteArray &body = content->body();
+    int i = 0;
+    while (i < body.size() && !isWhitespace(body.at(i))) {
+        i++;
+    }
+    if (i == body.size()) {
+        return body;
+    }
+    QByteArray result;
+    result.reserve(body.size());
+    for (i = 0; i < body.size(); i++) {
+        const char c = body.at(i);
+        if (!isWhitespace(c)) {
+            result.append(c);
+        }
+    }
+    return result;
+}
+
+void getAttachments(KCalCore::Incidence::Ptr incidence, const QStringList &attachments, const PartIndex &mimeData)
 {
     if (!incidence) {
         Error() << "Invalid incidence";
@@ -254,21 +397,19 @@ void getAttachments(KCalCore::Incidence::Ptr incidence, const QStringList &attac
 //     kDebug() << mimeData->encodedContent();
     foreach (const QString &name, attachments) {
         QByteArray type;
-        KMime::Content *content = findContentByName(mimeData, name, type);
+        KMime::Content *content = mimeData.findByName(name, type);
         if (!content) { // guard against malformed events with non-existent attachments
             Warning() << "could not find attachment: "<< name.toUtf8() << type;
             continue;
         }
-        const QByteArray c = content->decodedContent().toBase64();
-//         Debug() << c;
-        KCalCore::Attachment::Ptr attachment( new KCalCore::Attachment( c, QString::fromLatin1( type ) ) );
+        KCalCore::Attachment::Ptr attachment( new KCalCore::Attachment( toBase64(content), QString::fromLatin1( type ) ) );
         attachment->setLabel( name );
         incidence->addAttachment(attachment);
         Debug() << "ATTACHMENT NAME" << name << type;
     }
 }
 
-void getAttachmentsById(KCalCore::Incidence::Ptr incidence, const KMime::Message::Ptr &mimeData)
+void getAttachmentsById(KCalCore::Incidence::Ptr incidence, const PartIndex &mimeData)
 {
     if (!incidence) {
         Error() << "Invalid incidence";
@@ -285,18 +426,96 @@ void getAttachmentsById(KCalCore::Incidence::Ptr incidence, const KMime::Message
         //It's a referenced attachmant, extract it
         QByteArray type;
         QString name;
-        KMime::Content *content = findContentById(mimeData, fromCid(attachment->uri()).toLatin1(), type, name);
+        KMime::Content *content = mimeData.findById(fromCid(attachment->uri()).toLatin1(), type, name);
         if (!content) { // guard against malformed events with non-existent attachments
             Error() << "could not find attachment: "<< name << type;
             continue;
         }
         attachment->setUri(QString());
-        attachment->setData(content->decodedContent().toBase64());
+        attachment->setData(toBase64(content));
         attachment->setMimeType(type);
         attachment->setLabel(name);
     }
 }
 
+/*
+ * Returns the size of the decoded content, without decoding base64 encoded parts.
+ */
+static uint decodedSize(KMime::Content *content)
+{
+    if (content->contentTransferEncoding()->decoded()) {
+        return content->body().size();
+    }
+    if (content->contentTransferEncoding()->encoding() != KMime::Headers::CEbase64) {
+        return content->decodedContent().size();
+    }
+    const QByteArray &body = content->body();
+    uint characters = 0;
+    uint padding = 0;
+    for (int i = 0; i < body.size(); i++) {
+        const char c = body.at(i);
+        if (c == '=') {
+            padding++;
+        } else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '+' || c == '/') {
+            characters++;
+        }
+    }
+    const uint size = (characters + padding) / 4 * 3;
+    //Malformed bodies may have more padding than data
+    return size > padding ? size - padding : 0;
+}
+
+void getAttachmentReferencesById(KCalCore::Incidence::Ptr incidence, const PartIndex &mimeData)
+{
+    if (!incidence) {
+        Error() << "Invalid incidence";
+        return;
+    }
+    foreach(KCalCore::Attachment::Ptr attachment, incidence->attachments()) {
+        if (!attachment->uri().contains("cid:")) {
+            continue;
+        }
+        QByteArray type;
+        QString name;
+        KMime::Content *content = mimeData.findById(fromCid(attachment->uri()).toLatin1(), type, name);
+        if (!content) { // guard against malformed events with non-existent attachments
+            Error() << "could not find attachment: "<< attachment->uri();
+            continue;
+        }
+        attachment->setMimeType(type);
+        attachment->setLabel(name);
+        attachment->setSize(decodedSize(content));
+    }
+}
+
+std::vector<Kolab::Attachment> getAttachmentsById(const std::vector<Kolab::Attachment> &attachments, const PartIndex &mimeData)
+{
+    std::vector<Kolab::Attachment> result;
+    result.reserve(attachments.size());
+    foreach (const Kolab::Attachment &attachment, attachments) {
+        const QString uri = Conversion::fromStdString(attachment.uri());
+        if (!uri.contains("cid:")) {
+            result.push_back(attachment);
+            continue;
+        }
+        //It's a referenced attachmant, extract it
+        QByteArray type;
+        QString name;
+        KMime::Content *content = mimeData.findById(fromCid(uri).toLatin1(), type, name);
+        if (!content) { // guard against malformed events with non-existent attachments
+            Error() << "could not find attachment: "<< uri;
+            result.push_back(attachment);
+            continue;
+        }
+        const QByteArray &data = content->decodedContent();
+        Kolab::Attachment a;
+        a.setData(std::string(data.constData(), data.size()), std::string(type.constData()));
+        a.setLabel(Conversion::toStdString(name));
+        result.push_back(a);
+    }
+    return result;
+}
+
 
 
 }; //Namespace
@@ -24,6 +24,8 @@
 #include <kcalcore/event.h>
 #include <kmime/kmime_message.h>
 #include <kabc/addressee.h>
+#include <kolabcontainers.h>
+#include <QHash>
 class QDomDocument;
 
 namespace Kolab {
@@ -31,7 +33,35 @@ namespace Kolab {
 
 KMime::Content* findContentByName(const KMime::Message::Ptr &data, const QString &name, QByteArray &type);
 KMime::Content* findContentByType(const KMime::Message::Ptr &data, const QByteArray &type);
+KMime::Content* findContentById(const KMime::Message::Ptr &data, const QByteArray &id, QByteArray &type, QString &name);
 QList<QByteArray> getContentMimeTypeList(const KMime::Message::Ptr &data);
+/**
+* Returns the content id of a cid: uri, or an empty string if @param cid is not a cid: uri
+*/
+QString fromCid(const QString &cid);
+
+/**
+* Index of the parts of a Mime message
+*
+* The index is built once and allows to look up any number of parts, without scanning all parts of the message for each lookup.
+* Like the find functions above, the lookups return the first matching part.
+*
+* The index doesn't own the parts, and must not be used after the message has been modified or destroyed.
+*/
+class PartIndex
+{
+public:
+    explicit PartIndex(const KMime::Message::Ptr &data);
+
+    KMime::Content* findByType(const QByteArray &type) const;
+    KMime::Content* findByName(const QString &name, QByteArray &type) const;
+    KMime::Content* findById(const QByteArray &id, QByteArray &type, QString &name) const;
+
+private:
+    QHash<QByteArray, KMime::Content*> mByType;
+    QHash<QString, KMime::Content*> mByName;
+    QHash<QByteArray, KMime::Content*> mById;
+};
 
 /**
 * Get Attachments from a Mime message
@@ -39,12 +69,28 @@ QList<QByteArray> getContentMimeTypeList(const KMime::Message::Ptr &data);
 * Set the attachments listed in @param attachments on @param incidence from @param mimeData
 */
 //v2
-void getAttachments(KCalCore::Incidence::Ptr incidence, const QStringList &attachments, const KMime::Message::Ptr &mimeData);
+void getAttachments(KCalCore::Incidence::Ptr incidence, const QStringList &attachments, const PartIndex &mimeData);
 //v3
-void getAttachmentsById(KCalCore::Incidence::Ptr incidence, const KMime::Message::Ptr &mimeData);
+void getAttachmentsById(KCalCore::Incidence::Ptr incidence, const PartIndex &mimeData);
+/**
+* Same as above, but for libkolabxml containers
+*
+* Returns @param attachments with all cid references resolved to the decoded attachment data found in @param mimeData
+*/
+std::vector<Kolab::Attachment> getAttachmentsById(const std::vector<Kolab::Attachment> &attachments, const PartIndex &mimeData);
+/**
+* Sets mimetype, label and size of the attachments referenced by cid on @param incidence, without decoding the attachments.
+*
+* The attachments keep their cid: uri.
+*/
+void getAttachmentReferencesById(KCalCore::Incidence::Ptr incidence, const PartIndex &mimeData);
 
 ///Generic serializing functions
 KMime::Message::Ptr createMessage(const KCalCore::Incidence::Ptr &incidencePtr, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, bool v3, const QString &prodid);
+/**
+* Creates a v3 message from the already serialized @param xml and the mime parts of the attachments referenced by it, taking ownership of @param attachmentParts
+*/
+KMime::Message::Ptr createMessage(const KCalCore::Incidence::Ptr &incidencePtr, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, const QString &prodid, const QList<KMime::Content*> &attachmentParts);
 KMime::Message::Ptr createMessage(const KABC::Addressee &contact, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, bool v3, const QString &prodid);
 KMime::Message::Ptr createMessage(const QString &subject, const QString &mimetype, const QString &xKolabType, const QByteArray &xml, bool v3, const QString &prodid);
 
@@ -52,6 +98,10 @@ KMime::Content* createExplanationPart();
 KMime::Message::Ptr createMessage(const QString& mimeType, bool v3, const QString &prodid);
 KMime::Content* createMainPart(const QString& mimeType, const QByteArray& decodedContent);
 KMime::Content* createAttachmentPart(const QByteArray &cid, const QString& mimeType, const QString& fileName, const QByteArray& decodedContent);
+/**
+* Creates the mime part of @param attachment, binary attachments are written without decoding them
+*/
+KMime::Content* createAttachmentPart(const QByteArray &cid, const KCalCore::Attachment::Ptr &attachment);
 
     };
 }; //Namespace
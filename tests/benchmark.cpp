@@ -18,6 +18,8 @@
 #include "benchmark.h"
 #include "kolabformatV2/event.h"
 #include "conversion/kcalconversion.h"
+#include "kolabformat/kolabobject.h"
+#include "kolabformat/mimeobject.h"
 #include <kmime/kmime_message.h>
 #include <kolabformat.h>
 #include <kdebug.h>
@@ -85,6 +87,108 @@ void BenchmarkTests::parsingBenchmarkComparison()
     }
 }
 
+void BenchmarkTests::mimeObjectBenchmark_data()
+{
+    QTest::addColumn<bool>("native");
+    QTest::newRow("kcalcore") << false;
+    QTest::newRow("native") << true;
+}
+
+/*
+ * Compares a read/write roundtrip of MIMEObject with the previous implementation,
+ * which converted every object to KCalCore and back.
+ */
+void BenchmarkTests::mimeObjectBenchmark()
+{
+    QFile file( TESTFILEDIR+QString::fromLatin1("/v3/event/complex.ics.mime") );
+    QVERIFY( file.open( QFile::ReadOnly ) );
+    const QByteArray data = file.readAll();
+    const std::string input(data.constData(), data.size());
+
+    QFETCH(bool, native);
+    if (native) {
+        Kolab::MIMEObject mimeobject;
+        QBENCHMARK {
+            mimeobject.writeEvent(mimeobject.readEvent(input), Kolab::KolabV3);
+        }
+    } else {
+        QBENCHMARK {
+            KMime::Message::Ptr msg(new KMime::Message);
+            msg->setContent( data );
+            msg->parse();
+            const Kolab::Event event = Kolab::Conversion::fromKCalCore(*Kolab::KolabObjectReader(msg).getEvent());
+            KMime::Message::Ptr result = Kolab::KolabObjectWriter::writeEvent(Kolab::Conversion::toKCalCore(event), Kolab::KolabV3);
+            result->assemble();
+            result->encodedContent();
+        }
+    }
+}
+
+void BenchmarkTests::mimeObjectInputBenchmark_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QString>("type");
+    QTest::addColumn<bool>("copy");
+    const QDir testFileDir(TESTFILEDIR);
+    QDirIterator it(testFileDir.path(), QStringList() << QString::fromLatin1("*.mime"), QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        const QString fileName = it.next();
+        const QFileInfo info(fileName);
+        QString type = info.dir().dirName();
+        if (type == QLatin1String("contacts") && info.fileName().startsWith(QLatin1String("distlist"))) {
+            type = QString::fromLatin1("distlist");
+        }
+        if (!(QStringList() << "event" << "task" << "journal" << "note" << "contacts" << "distlist").contains(type)) {
+            continue;
+        }
+        const QString name = testFileDir.relativeFilePath(fileName);
+        QTest::newRow(QString::fromLatin1("%1 copy").arg(name).toLatin1()) << fileName << type << true;
+        QTest::newRow(QString::fromLatin1("%1 view").arg(name).toLatin1()) << fileName << type << false;
+    }
+}
+
+template <typename T>
+static void benchmarkRead(Kolab::MIMEObject &mimeobject, T (Kolab::MIMEObject::*readCopy)(const std::string &), T (Kolab::MIMEObject::*readView)(const char *, std::size_t), const QByteArray &data, bool copy)
+{
+    if (copy) {
+        QBENCHMARK {
+            (mimeobject.*readCopy)(std::string(data.constData(), data.size()));
+        }
+    } else {
+        QBENCHMARK {
+            (mimeobject.*readView)(data.constData(), data.size());
+        }
+    }
+}
+
+/*
+ * Reading a QByteArray with the std::string overload requires a copy of the complete message,
+ * while the pointer/size overload reads from the QByteArray directly.
+ */
+void BenchmarkTests::mimeObjectInputBenchmark()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QString, type);
+    QFETCH(bool, copy);
+    QFile file( fileName );
+    QVERIFY( file.open( QFile::ReadOnly ) );
+    const QByteArray data = file.readAll();
+
+    Kolab::MIMEObject mimeobject;
+    if (type == QLatin1String("event")) {
+        benchmarkRead<Kolab::Event>(mimeobject, &Kolab::MIMEObject::readEvent, &Kolab::MIMEObject::readEvent, data, copy);
+    } else if (type == QLatin1String("task")) {
+        benchmarkRead<Kolab::Todo>(mimeobject, &Kolab::MIMEObject::readTodo, &Kolab::MIMEObject::readTodo, data, copy);
+    } else if (type == QLatin1String("journal")) {
+        benchmarkRead<Kolab::Journal>(mimeobject, &Kolab::MIMEObject::readJournal, &Kolab::MIMEObject::readJournal, data, copy);
+    } else if (type == QLatin1String("note")) {
+        benchmarkRead<Kolab::Note>(mimeobject, &Kolab::MIMEObject::readNote, &Kolab::MIMEObject::readNote, data, copy);
+    } else if (type == QLatin1String("contacts")) {
+        benchmarkRead<Kolab::Contact>(mimeobject, &Kolab::MIMEObject::readContact, &Kolab::MIMEObject::readContact, data, copy);
+    } else {
+        benchmarkRead<Kolab::DistList>(mimeobject, &Kolab::MIMEObject::readDistlist, &Kolab::MIMEObject::readDistlist, data, copy);
+    }
+}
 
 QTEST_MAIN( BenchmarkTests )
 
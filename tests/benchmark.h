@@ -29,6 +29,12 @@ private slots:
     
     void parsingBenchmarkComparison_data();
     void parsingBenchmarkComparison();
+
+    void mimeObjectBenchmark_data();
+    void mimeObjectBenchmark();
+
+    void mimeObjectInputBenchmark_data();
+    void mimeObjectInputBenchmark();
     
 };
 
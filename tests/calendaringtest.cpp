@@ -25,6 +25,11 @@
 #include <calendaring/calendaring.h>
 #include <calendaring/event.h>
 #include <calendaring/datetimeutils.h>
+#include <calendaring/recurrence.h>
+#include <conversion/kcalconversion.h>
+#include <conversion/commonconversion.h>
+#include <kolabformat/mimeobject.h>
+#include <QFile>
 
 #include "testhelpers.h"
 #include "testutils.h"
@@ -167,6 +172,125 @@ void CalendaringTest::testEventConflictSet()
     }
 }
 
+void CalendaringTest::testEventConflictSetSweep()
+{
+    //Compare with the pairwise checks using conflicts()
+    qsrand(1);
+    std::vector<Kolab::Event> events;
+    std::vector<Kolab::Event> events2;
+    for (int i = 0; i < 300; i++) {
+        const int day = qrand() % 20 + 1;
+        const int hour = qrand() % 20;
+        if (i % 10 == 0) {
+            events.push_back(createEvent(Kolab::cDateTime(2012,5,day), Kolab::cDateTime(2012,5,day)));
+        } else {
+            events.push_back(createEvent(Kolab::cDateTime(2012,5,day,hour,0,0,true), Kolab::cDateTime(2012,5,day,hour + qrand() % 4,0,0,true)));
+        }
+        if (i % 3 == 0) {
+            events2.push_back(createEvent(Kolab::cDateTime("Europe/Zurich",2012,5,day,hour,30,0), Kolab::cDateTime("Europe/Zurich",2012,5,day,hour + 1,0,0)));
+        }
+    }
+    std::vector< std::vector<Kolab::Event> > expectedResult;
+    for (std::size_t i = 0; i < events.size(); i++) {
+        std::vector<Kolab::Event> set;
+        set.push_back(events.at(i));
+        for (std::size_t q = i + 1; q < events.size(); q++) {
+            if (Kolab::Calendaring::conflicts(events.at(i), events.at(q))) {
+                set.push_back(events.at(q));
+            }
+        }
+        for (std::size_t m = 0; m < events2.size(); m++) {
+            if (Kolab::Calendaring::conflicts(events.at(i), events2.at(m))) {
+                set.push_back(events2.at(m));
+            }
+        }
+        if (set.size() > 1) {
+            expectedResult.push_back(set);
+        }
+    }
+
+    const std::vector< std::vector<Kolab::Event> > result = Kolab::Calendaring::getConflictingSets(events, events2);
+    QCOMPARE(result.size(), expectedResult.size());
+    for (std::size_t i = 0; i < result.size(); i++) {
+        QCOMPARE(result.at(i).size(), expectedResult.at(i).size());
+        for (std::size_t j = 0; j < result.at(i).size(); j++) {
+            QCOMPARE(result.at(i).at(j).uid(), expectedResult.at(i).at(j).uid());
+        }
+    }
+}
+
+static Kolab::Event createRecurringEvent(const Kolab::cDateTime &start, const Kolab::cDateTime &end, Kolab::RecurrenceRule::Frequency freq, int count)
+{
+    Kolab::Event event = createEvent(start, end);
+    Kolab::RecurrenceRule rrule;
+    rrule.setFrequency(freq);
+    rrule.setInterval(1);
+    rrule.setCount(count);
+    event.setRecurrenceRule(rrule);
+    return event;
+}
+
+void CalendaringTest::testOccurrenceConflicts()
+{
+    const Kolab::Event daily = createRecurringEvent(Kolab::cDateTime(2012,5,1,10,0,0,true), Kolab::cDateTime(2012,5,1,11,0,0,true), Kolab::RecurrenceRule::Daily, 5);
+    const Kolab::Event weekly = createRecurringEvent(Kolab::cDateTime(2012,4,26,10,30,0,true), Kolab::cDateTime(2012,4,26,12,0,0,true), Kolab::RecurrenceRule::Weekly, 0);
+    const Kolab::Event single = createEvent(Kolab::cDateTime(2012,5,4,11,0,0,true), Kolab::cDateTime(2012,5,4,12,0,0,true));
+    const Kolab::cDateTime start(2012,4,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,6,1,0,0,0,true);
+
+    //The masters don't conflict, the occurrences do
+    QVERIFY(!Kolab::Calendaring::conflicts(daily, weekly));
+    const std::vector<Kolab::Calendaring::OccurrenceConflict> pair = Kolab::Calendaring::getConflictingOccurrences(daily, weekly, start, end);
+    QCOMPARE((int)pair.size(), 1);
+    QCOMPARE(pair.at(0).first, (std::size_t)0);
+    QCOMPARE(pair.at(0).second, (std::size_t)1);
+    QCOMPARE(pair.at(0).firstStart, Kolab::cDateTime(2012,5,3,10,0,0,true));
+    QCOMPARE(pair.at(0).secondStart, Kolab::cDateTime(2012,5,3,10,30,0,true));
+
+    std::vector<Kolab::Event> events;
+    events.push_back(daily);
+    events.push_back(weekly);
+    events.push_back(single);
+    const std::vector<Kolab::Calendaring::OccurrenceConflict> result = Kolab::Calendaring::getConflictingOccurrences(events, start, end);
+    QCOMPARE((int)result.size(), 2);
+    QCOMPARE(result.at(0).secondStart, Kolab::cDateTime(2012,5,3,10,30,0,true));
+    QCOMPARE(result.at(1).first, (std::size_t)0);
+    QCOMPARE(result.at(1).second, (std::size_t)2);
+    QCOMPARE(result.at(1).firstStart, Kolab::cDateTime(2012,5,4,10,0,0,true));
+
+    //The occurrences replaced by exceptions don't conflict anymore
+    Kolab::Event moved = createEvent(Kolab::cDateTime(2012,5,3,14,0,0,true), Kolab::cDateTime(2012,5,3,15,0,0,true));
+    moved.setUid(daily.uid());
+    moved.setRecurrenceID(Kolab::cDateTime(2012,5,3,10,0,0,true), false);
+    events.push_back(moved);
+    const std::vector<Kolab::Calendaring::OccurrenceConflict> withException = Kolab::Calendaring::getConflictingOccurrences(events, start, end);
+    QCOMPARE((int)withException.size(), 1);
+    QCOMPARE(withException.at(0).second, (std::size_t)2);
+
+    //Events without uid are separate series, and an exception without uid doesn't replace any occurrence
+    Kolab::Event first = createEvent(Kolab::cDateTime(2012,5,10,10,0,0,true), Kolab::cDateTime(2012,5,10,11,0,0,true));
+    first.setUid(std::string());
+    Kolab::Event second = createEvent(Kolab::cDateTime(2012,5,10,10,30,0,true), Kolab::cDateTime(2012,5,10,11,30,0,true));
+    second.setUid(std::string());
+    Kolab::Event recurring = createRecurringEvent(Kolab::cDateTime(2012,5,20,10,0,0,true), Kolab::cDateTime(2012,5,20,11,0,0,true), Kolab::RecurrenceRule::Daily, 2);
+    recurring.setUid(std::string());
+    Kolab::Event exception = createEvent(Kolab::cDateTime(2012,5,21,10,30,0,true), Kolab::cDateTime(2012,5,21,11,30,0,true));
+    exception.setUid(std::string());
+    exception.setRecurrenceID(Kolab::cDateTime(2012,5,21,10,0,0,true), false);
+    std::vector<Kolab::Event> withoutUid;
+    withoutUid.push_back(first);
+    withoutUid.push_back(second);
+    withoutUid.push_back(recurring);
+    withoutUid.push_back(exception);
+    const std::vector<Kolab::Calendaring::OccurrenceConflict> uidless = Kolab::Calendaring::getConflictingOccurrences(withoutUid, start, end);
+    QCOMPARE((int)uidless.size(), 2);
+    QCOMPARE(uidless.at(0).first, (std::size_t)0);
+    QCOMPARE(uidless.at(0).second, (std::size_t)1);
+    QCOMPARE(uidless.at(1).first, (std::size_t)2);
+    QCOMPARE(uidless.at(1).second, (std::size_t)3);
+    QCOMPARE(uidless.at(1).firstStart, Kolab::cDateTime(2012,5,21,10,0,0,true));
+}
+
 void CalendaringTest::testTimesInInterval_data()
 {
     QTest::addColumn<Kolab::Event>( "event" );
@@ -192,6 +316,12 @@ void CalendaringTest::testTimesInInterval_data()
             result.push_back(Kolab::cDateTime(2011,1,5,1,1,1,true));
             QTest::newRow( "simple" ) << event << Kolab::cDateTime(2011,1,1,1,1,1,true) << Kolab::cDateTime(2011,1,5,1,1,1,true) << result;
         }
+        {
+            Kolab::Event event;
+            event.setStart(Kolab::cDateTime(2011,1,1,1,1,1,true));
+            event.setEnd(Kolab::cDateTime(2011,1,1,2,1,1,true));
+            QTest::newRow( "nonrecurring" ) << event << Kolab::cDateTime(2011,1,1,0,0,0,true) << Kolab::cDateTime(2011,1,5,1,1,1,true) << std::vector<Kolab::cDateTime>();
+        }
     }
 }
 
@@ -223,6 +353,157 @@ void CalendaringTest::testTimesInIntervalBenchmark()
 //     qDebug() << QTest::toString(result);
 }
 
+/*
+ * The same expansion as above with KCalCore, which timeInInterval used for all events before.
+ */
+void CalendaringTest::testTimesInIntervalKCalCoreBenchmark()
+{
+    Kolab::Event event;
+    event.setStart(Kolab::cDateTime(2011,1,1,1,1,1));
+    event.setEnd(Kolab::cDateTime(2011,1,1,2,1,1));
+    Kolab::RecurrenceRule rrule;
+    rrule.setFrequency(Kolab::RecurrenceRule::Daily);
+    rrule.setInterval(1);
+    rrule.setCount(500);
+    event.setRecurrenceRule(rrule);
+
+    const KDateTime start = Kolab::Conversion::toDate(Kolab::cDateTime(2011,1,1,1,1,1));
+    const KDateTime end = Kolab::Conversion::toDate(Kolab::cDateTime(2013,1,1,1,1,1));
+    QBENCHMARK {
+        std::vector<Kolab::cDateTime> result;
+        Q_FOREACH (const KDateTime &dt, Kolab::Conversion::toKCalCore(event)->recurrence()->timesInInterval(start, end)) {
+            result.push_back(Kolab::Conversion::fromDate(dt));
+        }
+    }
+}
+
+static Kolab::Event readEvent(const char *file)
+{
+    QFile f(getPath(file));
+    if (!f.open(QFile::ReadOnly)) {
+        return Kolab::Event();
+    }
+    const QByteArray data = f.readAll();
+    Kolab::MIMEObject mimeobject;
+    return mimeobject.readEvent(data.constData(), data.size());
+}
+
+static Kolab::Event createRecurringEvent(const Kolab::cDateTime &start, const Kolab::RecurrenceRule &rrule)
+{
+    Kolab::Event event;
+    event.setStart(start);
+    Kolab::cDateTime end(start.year(), start.month(), start.day(), start.hour() + 1, start.minute(), start.second(), start.isUTC());
+    end.setTimezone(start.timezone());
+    event.setEnd(end);
+    event.setRecurrenceRule(rrule);
+    return event;
+}
+
+static std::vector<Kolab::DayPos> createByDay(int occurence, Kolab::Weekday weekday)
+{
+    return std::vector<Kolab::DayPos>(1, Kolab::DayPos(occurence, weekday));
+}
+
+void CalendaringTest::testNativeRecurrence_data()
+{
+    QTest::addColumn<Kolab::Event>( "event" );
+    QTest::addColumn<Kolab::cDateTime>( "start" );
+    QTest::addColumn<Kolab::cDateTime>( "end" );
+
+    const Kolab::cDateTime start(2009,1,1,0,0,0,true);
+    const Kolab::cDateTime end(2016,1,1,0,0,0,true);
+    QTest::newRow( "v2complex" ) << readEvent("v2/event/complex.ics.mime") << start << end;
+    QTest::newRow( "v2attachmentUtf8" ) << readEvent("v2/event/attachmentUtf8.ics.mime") << start << end;
+    QTest::newRow( "v3complex" ) << readEvent("v3/event/complex.ics.mime") << start << end;
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Weekly);
+        rrule.setInterval(2);
+        std::vector<Kolab::DayPos> byday;
+        byday.push_back(Kolab::DayPos(0, Kolab::Monday));
+        byday.push_back(Kolab::DayPos(0, Kolab::Thursday));
+        rrule.setByday(byday);
+        rrule.setEnd(Kolab::cDateTime(2013,6,1,0,0,0,true));
+        //Over the daylight saving time changes
+        Kolab::Event event = createRecurringEvent(Kolab::cDateTime("Europe/Berlin",2012,1,2,10,0,0), rrule);
+        std::vector<Kolab::cDateTime> exdates;
+        exdates.push_back(Kolab::cDateTime("Europe/Berlin",2012,4,12,10,0,0));
+        exdates.push_back(Kolab::cDateTime(2012,5,24));
+        event.setExceptionDates(exdates);
+        std::vector<Kolab::cDateTime> rdates;
+        rdates.push_back(Kolab::cDateTime("Europe/Berlin",2012,3,3,12,0,0));
+        rdates.push_back(Kolab::cDateTime(2012,3,4));
+        event.setRecurrenceDates(rdates);
+        QTest::newRow( "weekly byday" ) << event << start << end;
+    }
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Monthly);
+        rrule.setInterval(1);
+        rrule.setByday(createByDay(-1, Kolab::Friday));
+        rrule.setCount(30);
+        QTest::newRow( "monthly last friday" ) << createRecurringEvent(Kolab::cDateTime("Europe/Berlin",2012,1,27,18,30,0), rrule) << start << end;
+    }
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Monthly);
+        rrule.setInterval(1);
+        rrule.setBymonthday(std::vector<int>(1, 31));
+        QTest::newRow( "monthly 31st" ) << createRecurringEvent(Kolab::cDateTime(2012,1,31,9,0,0,true), rrule) << start << end;
+    }
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Monthly);
+        rrule.setInterval(3);
+        rrule.setBymonthday(std::vector<int>(1, -1));
+        QTest::newRow( "quarterly last day" ) << createRecurringEvent(Kolab::cDateTime(2012,3,31,9,0,0), rrule) << start << end;
+    }
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Yearly);
+        rrule.setInterval(1);
+        rrule.setBymonth(std::vector<int>(1, 11));
+        rrule.setByday(createByDay(4, Kolab::Thursday));
+        QTest::newRow( "yearly fourth thursday" ) << createRecurringEvent(Kolab::cDateTime("America/New_York",2011,11,24,12,0,0), rrule) << start << end;
+    }
+    {
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Daily);
+        rrule.setInterval(3);
+        std::vector<Kolab::DayPos> byday;
+        byday.push_back(Kolab::DayPos(0, Kolab::Saturday));
+        byday.push_back(Kolab::DayPos(0, Kolab::Sunday));
+        rrule.setByday(byday);
+        rrule.setBymonth(std::vector<int>(1, 7));
+        QTest::newRow( "daily filtered" ) << createRecurringEvent(Kolab::cDateTime(2012,7,1,8,0,0,true), rrule) << start << end;
+    }
+}
+
+/*
+ * The native recurrence expansion has to return the same occurrences as KCalCore.
+ */
+void CalendaringTest::testNativeRecurrence()
+{
+    QFETCH(Kolab::Event, event);
+    QFETCH(Kolab::cDateTime, start);
+    QFETCH(Kolab::cDateTime, end);
+
+    QVERIFY(Kolab::Calendaring::Recurrence(event).isSupported());
+    const KCalCore::Event::Ptr kcalEvent = Kolab::Conversion::toKCalCore(event);
+    std::vector<Kolab::cDateTime> expected;
+    Q_FOREACH (const KDateTime &dt, kcalEvent->recurrence()->timesInInterval(Kolab::Conversion::toDate(start), Kolab::Conversion::toDate(end))) {
+        expected.push_back(Kolab::Conversion::fromDate(dt));
+    }
+    QVERIFY(!expected.empty());
+    QCOMPARE(Kolab::Calendaring::timeInInterval(event, start, end), expected);
+
+    Kolab::Calendaring::Event calendaringEvent(event);
+    Q_FOREACH (const Kolab::cDateTime &occurrence, expected) {
+        const KDateTime next = kcalEvent->recurrence()->getNextDateTime(Kolab::Conversion::toDate(occurrence));
+        QCOMPARE(calendaringEvent.getNextOccurence(occurrence), next.isValid() ? Kolab::Conversion::fromDate(next) : Kolab::cDateTime());
+    }
+}
+
 void CalendaringTest::testCalendar_data()
 {
     QTest::addColumn< std::vector<Kolab::Event> >( "inputevents" );
@@ -296,6 +577,24 @@ void CalendaringTest::testCalendar_data()
         expectedResult.push_back(createEvent(Kolab::cDateTime("Europe/Zurich",2012,5,5,7,4,4), Kolab::cDateTime("Europe/Zurich",2012,5,5,7+1,4,4)));
         QTest::newRow( "startEndTimeInclusive" ) << inputevents << Kolab::cDateTime("Europe/Zurich",2012,5,5,3,4,4) << Kolab::cDateTime("Europe/Zurich",2012,5,5,7,4,4) << expectedResult;
     }
+
+    { //Events spanning the interval, and all-day events
+        //All-day events are in local time, the dates are chosen so the result is the same in every timezone
+        std::vector<Kolab::Event> inputevents;
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,5,5,12,30,0, true), Kolab::cDateTime(2012,5,5,13,30,0, true)));
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,5,1,1,0,0, true), Kolab::cDateTime(2012,5,20,1,0,0, true)));
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,5,5), Kolab::cDateTime(2012,5,5)));
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,5,2), Kolab::cDateTime(2012,5,2)));
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,5,5,13,0,0, true), Kolab::cDateTime()));
+        inputevents.push_back(createEvent(Kolab::cDateTime(2012,4,1,1,0,0, true), Kolab::cDateTime(2012,4,20,1,0,0, true)));
+
+        std::vector<Kolab::Event> expectedResult;
+        expectedResult.push_back(createEvent(Kolab::cDateTime(2012,5,1,1,0,0, true), Kolab::cDateTime(2012,5,20,1,0,0, true)));
+        expectedResult.push_back(createEvent(Kolab::cDateTime(2012,5,5), Kolab::cDateTime(2012,5,5)));
+        expectedResult.push_back(createEvent(Kolab::cDateTime(2012,5,5,12,30,0, true), Kolab::cDateTime(2012,5,5,13,30,0, true)));
+        expectedResult.push_back(createEvent(Kolab::cDateTime(2012,5,5,13,0,0, true), Kolab::cDateTime()));
+        QTest::newRow( "overlapping" ) << inputevents << Kolab::cDateTime(2012,5,5,8,0,0, true) << Kolab::cDateTime(2012,5,5,14,0,0, true) << expectedResult;
+    }
     
 }
 
@@ -312,9 +611,6 @@ void CalendaringTest::testCalendar()
         cal.addEvent(event);
     }
     const std::vector<Kolab::Event> result = cal.getEvents(start, end, true);
-    foreach (const Kolab::Event &event, result) {
-        qDebug() << QTest::toString(event.start()) << QTest::toString(event.end());
-    }
     compareEvents(result, expectedResult);
 }
 
@@ -417,6 +713,83 @@ void CalendaringTest::testRecurrence()
         
 }
 
+void CalendaringTest::testOccurrenceIterator_data()
+{
+    QTest::addColumn<Kolab::Event>( "event" );
+    {
+        Kolab::Event event;
+        event.setStart(Kolab::cDateTime(2011,1,1,1,1,1));
+        event.setEnd(Kolab::cDateTime(2011,1,1,2,1,1));
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Daily);
+        rrule.setInterval(1);
+        rrule.setCount(10);
+        event.setRecurrenceRule(rrule);
+        QTest::newRow( "native" ) << event;
+    }
+    {
+        //All-day events are expanded by KCalCore
+        Kolab::Event event;
+        event.setStart(Kolab::cDateTime(2011,1,1));
+        event.setEnd(Kolab::cDateTime(2011,1,2));
+        Kolab::RecurrenceRule rrule;
+        rrule.setFrequency(Kolab::RecurrenceRule::Weekly);
+        rrule.setInterval(1);
+        rrule.setCount(10);
+        event.setRecurrenceRule(rrule);
+        QTest::newRow( "kcalcore" ) << event;
+    }
+    {
+        Kolab::Event event;
+        event.setStart(Kolab::cDateTime(2011,1,1,1,1,1,true));
+        event.setEnd(Kolab::cDateTime(2011,1,1,2,1,1,true));
+        QTest::newRow( "not recurring" ) << event;
+    }
+}
+
+/*
+ * The iterator has to return the same occurrences as getNextOccurence and getOccurenceEndDate.
+ */
+void CalendaringTest::testOccurrenceIterator()
+{
+    QFETCH(Kolab::Event, event);
+    Kolab::Calendaring::Event calendaringEvent(event);
+
+    std::vector<Kolab::cDateTime> starts;
+    Kolab::Calendaring::OccurrenceIterator it(event);
+    QVERIFY(!it.start().isValid());
+    Kolab::cDateTime expected = event.start();
+    while (it.next()) {
+        QCOMPARE(it.start(), expected);
+        QCOMPARE(it.end(), calendaringEvent.getOccurenceEndDate(expected));
+        starts.push_back(it.start());
+        expected = calendaringEvent.getNextOccurence(expected);
+    }
+    QVERIFY(!expected.isValid());
+    QVERIFY(!it.start().isValid());
+    QVERIFY(!it.end().isValid());
+    QVERIFY(!it.next());
+    QCOMPARE(starts.size(), event.recurrenceRule().isValid() ? std::size_t(10) : std::size_t(1));
+
+    //Seeking to an occurrence returns it, seeking after it returns the following one
+    it.seek(starts.back());
+    QVERIFY(it.next());
+    QCOMPARE(it.start(), starts.back());
+    QVERIFY(!it.next());
+    if (starts.size() > 2) {
+        Kolab::cDateTime after = starts.at(1);
+        after.setDate(after.year(), after.month(), after.day() + 1);
+        it.seek(after);
+        QVERIFY(it.next());
+        QCOMPARE(it.start(), starts.at(2));
+    }
+    it.seek(Kolab::cDateTime(2010,1,1,0,0,0,true));
+    QVERIFY(it.next());
+    QCOMPARE(it.start(), starts.front());
+    it.seek(Kolab::cDateTime(2013,1,1,0,0,0,true));
+    QVERIFY(!it.next());
+}
+
 void CalendaringTest::testDateTimeUtils()
 {
     std::cout << Kolab::DateTimeUtils::getLocalTimezone() << std::endl;
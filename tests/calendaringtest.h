@@ -32,10 +32,15 @@ private slots:
     void testEventConflict();
 
     void testEventConflictSet();
+    void testEventConflictSetSweep();
+    void testOccurrenceConflicts();
 
     void testTimesInInterval_data();
     void testTimesInInterval();
     void testTimesInIntervalBenchmark();
+    void testTimesInIntervalKCalCoreBenchmark();
+    void testNativeRecurrence_data();
+    void testNativeRecurrence();
 
     void testCalendar_data();
     void testCalendar();
@@ -47,6 +52,8 @@ private slots:
     void testIMip();
 
     void testRecurrence();
+    void testOccurrenceIterator_data();
+    void testOccurrenceIterator();
 
     void testDateTimeUtils();
 };
@@ -20,6 +20,7 @@
 #include "kolabformat/errorhandler.h"
 
 #include <QTest>
+#include <QtConcurrentRun>
 
 void DebugStreamTest::testDebugstream()
 {
@@ -50,6 +51,98 @@ void DebugStreamTest::testHasError()
     QCOMPARE(Kolab::ErrorHandler::errorOccured(), false);
 }
 
+static bool reportError()
+{
+    Kolab::ErrorHandler::clearErrors();
+    Error() << "error in other thread";
+    return Kolab::ErrorHandler::errorOccured();
+}
+
+void DebugStreamTest::testThreadLocalErrors()
+{
+    Kolab::ErrorHandler::clearErrors();
+    QCOMPARE(QtConcurrent::run(reportError).result(), true);
+    QCOMPARE(Kolab::ErrorHandler::errorOccured(), false);
+    QCOMPARE(Kolab::ErrorHandler::instance().getErrors().size(), 0);
+}
+
+struct FormatCounter {};
+static int formatCount = 0;
+
+QDebug operator<<(QDebug dbg, const FormatCounter &)
+{
+    formatCount++;
+    return dbg;
+}
+
+void DebugStreamTest::testDisabledDebugNotFormatted()
+{
+    formatCount = 0;
+    Debug() << FormatCounter();
+    QCOMPARE(formatCount, 0);
+    Warning() << FormatCounter();
+    QCOMPARE(formatCount, 1);
+    Kolab::ErrorHandler::clearErrors();
+}
+
+class TestSink: public Kolab::ErrorSink
+{
+public:
+    virtual void log(const Record &record)
+    {
+        records.append(record);
+    }
+    QList<Record> records;
+};
+
+void DebugStreamTest::testSink()
+{
+    TestSink sink;
+    Kolab::ErrorHandler::setSink(&sink);
+    Kolab::ErrorHandler::clearErrors();
+    Kolab::ErrorHandler::setObjectUid("uid");
+    Debug() << "debug";
+    Error() << "error";
+    Kolab::ErrorHandler::setSeverityThreshold(Kolab::ErrorHandler::Debug);
+    Debug() << "debug2";
+    Kolab::ErrorHandler::setSeverityThreshold(Kolab::ErrorHandler::Warning);
+    Kolab::ErrorHandler::setSink(0);
+    Error() << "not logged";
+
+    QCOMPARE(sink.records.size(), 2);
+    QCOMPARE(sink.records.at(0).severity, Kolab::ErrorHandler::Error);
+    QVERIFY(sink.records.at(0).message.contains("error"));
+    QCOMPARE(sink.records.at(0).objectUid, QString::fromLatin1("uid"));
+    QCOMPARE(sink.records.at(0).file, QByteArray(__FILE__));
+    QVERIFY(sink.records.at(0).line > 0);
+    QCOMPARE(sink.records.at(1).severity, Kolab::ErrorHandler::Debug);
+    QVERIFY(sink.records.at(1).message.contains("debug2"));
+    Kolab::ErrorHandler::clearErrors();
+}
+
+static void addLocationError()
+{
+    //The location is converted to a temporary inside of addError
+    Kolab::ErrorHandler::instance().addError(Kolab::ErrorHandler::Error, QString::fromLatin1("error"), QString::fromLatin1("location(1)"));
+}
+
+/*
+ * Sinks may keep the records and process them after log() returned (e.g. asynchronously).
+ */
+void DebugStreamTest::testSinkRecordLifetime()
+{
+    TestSink sink;
+    Kolab::ErrorHandler::setSink(&sink);
+    addLocationError();
+    Error() << "error";
+    Kolab::ErrorHandler::setSink(0);
+
+    QCOMPARE(sink.records.size(), 2);
+    QCOMPARE(sink.records.at(0).file, QByteArray("location(1)"));
+    QCOMPARE(sink.records.at(0).line, -1);
+    QCOMPARE(sink.records.at(1).file, QByteArray(__FILE__));
+    Kolab::ErrorHandler::clearErrors();
+}
 
 QTEST_MAIN( DebugStreamTest )
 
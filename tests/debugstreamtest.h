@@ -27,6 +27,10 @@ private slots:
     void testDebugstream();
     void testDebugNotLogged();
     void testHasError();
+    void testThreadLocalErrors();
+    void testDisabledDebugNotFormatted();
+    void testSink();
+    void testSinkRecordLifetime();
 };
 
 #endif // DEBUGSTREAMTEST_H
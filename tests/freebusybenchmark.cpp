@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "freebusybenchmark.h"
+#include "freebusy/freebusy.h"
+#include <kolabevent.h>
+#include <kolabfreebusy.h>
+#include <QElapsedTimer>
+#include <QFile>
+
+static const int eventsPerUser = 1000;
+
+/*
+ * Simple linear congruential generator, so the calendars are the same for every run.
+ */
+class Random
+{
+public:
+    Random(): mState(42) {}
+    int next(int max)
+    {
+        mState = mState * 1103515245 + 12345;
+        return (mState >> 16) % max;
+    }
+private:
+    quint32 mState;
+};
+
+static Kolab::cDateTime createDateTime(int year, int month, int day, int hour, int minute, int zone)
+{
+    switch (zone) {
+        case 0: {
+            Kolab::cDateTime dt(year, month, day, hour, minute, 0);
+            dt.setTimezone("Europe/Berlin");
+            return dt;
+        }
+        case 1: {
+            Kolab::cDateTime dt(year, month, day, hour, minute, 0);
+            dt.setTimezone("America/New_York");
+            return dt;
+        }
+        case 2:
+            return Kolab::cDateTime(year, month, day, hour, minute, 0); //floating
+        default:
+            return Kolab::cDateTime(year, month, day, hour, minute, 0, true);
+    }
+}
+
+/*
+ * Creates a calendar of roughly 60% single events, 15% weekly, 10% daily, 5% monthly and 10% all-day events,
+ * distributed over the year 2012.
+ */
+static std::vector<Kolab::Event> createCalendar(int size)
+{
+    Random random;
+    std::vector<Kolab::Event> events;
+    events.reserve(size);
+    for (int i = 0; i < size; i++) {
+        Kolab::Event event;
+        event.setUid(QString::fromLatin1("uid%1").arg(i).toStdString());
+        event.setSummary("summary");
+        const int month = random.next(12) + 1;
+        const int day = random.next(28) + 1;
+        const int kind = random.next(100);
+        if (kind < 10) {
+            event.setStart(Kolab::cDateTime(2012, month, day));
+            event.setEnd(Kolab::cDateTime(2012, month, day));
+        } else {
+            const int zone = random.next(6);
+            const int hour = random.next(20);
+            const int minute = random.next(4) * 15;
+            event.setStart(createDateTime(2012, month, day, hour, minute, zone));
+            event.setEnd(createDateTime(2012, month, day, hour + 1, minute, zone));
+        }
+        if (kind >= 60) {
+            Kolab::RecurrenceRule rrule;
+            rrule.setInterval(1);
+            if (kind < 75) {
+                rrule.setFrequency(Kolab::RecurrenceRule::Weekly);
+            } else if (kind < 85) {
+                rrule.setFrequency(Kolab::RecurrenceRule::Daily);
+                rrule.setCount(random.next(30) + 1);
+            } else if (kind < 90) {
+                rrule.setFrequency(Kolab::RecurrenceRule::Monthly);
+                rrule.setBymonthday(std::vector<int>(1, day));
+            } else {
+                rrule.setFrequency(Kolab::RecurrenceRule::Yearly);
+            }
+            event.setRecurrenceRule(rrule);
+        }
+        events.push_back(event);
+    }
+    return events;
+}
+
+/*
+ * Returns the peak resident set size of the process in kB (Linux only).
+ */
+static QByteArray peakMemory()
+{
+    QFile file(QString::fromLatin1("/proc/self/status"));
+    if (!file.open(QFile::ReadOnly)) {
+        return "unknown";
+    }
+    Q_FOREACH (const QByteArray &line, file.readAll().split('\n')) {
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed();
+        }
+    }
+    return "unknown";
+}
+
+static void addSizes()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+    if (!qgetenv("FREEBUSY_BENCHMARK_LARGE").isEmpty()) {
+        QTest::newRow("1M") << 1000000;
+    }
+}
+
+static std::vector<Kolab::Freebusy> createFreebusyLists(int size)
+{
+    const std::vector<Kolab::Event> events = createCalendar(size);
+    std::vector<Kolab::Freebusy> fbList;
+    for (int i = 0; i < size; i += eventsPerUser) {
+        const std::vector<Kolab::Event> userEvents(events.begin() + i, events.begin() + qMin(size, i + eventsPerUser));
+        fbList.push_back(Kolab::FreebusyUtils::generateFreeBusy(userEvents, Kolab::cDateTime(2012,5,1,0,0,0,true), Kolab::cDateTime(2012,8,1,0,0,0,true)));
+    }
+    return fbList;
+}
+
+static void report(const char *operation, int size, qint64 msecs)
+{
+    qDebug() << operation << size << "events:" << (msecs ? size * 1000 / msecs : 0) << "events/s, peak memory:" << peakMemory();
+}
+
+void FreebusyBenchmark::generateFreeBusyBenchmark_data()
+{
+    addSizes();
+}
+
+void FreebusyBenchmark::generateFreeBusyBenchmark()
+{
+    QFETCH(int, size);
+    const std::vector<Kolab::Event> events = createCalendar(size);
+    const Kolab::cDateTime start(2012,5,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,8,1,0,0,0,true);
+
+    QElapsedTimer timer;
+    timer.start();
+    Kolab::FreebusyUtils::generateFreeBusy(events, start, end);
+    report("generateFreeBusy", size, timer.elapsed());
+
+    QBENCHMARK {
+        Kolab::FreebusyUtils::generateFreeBusy(events, start, end);
+    }
+}
+
+void FreebusyBenchmark::aggregateFreeBusyBenchmark_data()
+{
+    addSizes();
+}
+
+void FreebusyBenchmark::aggregateFreeBusyBenchmark()
+{
+    QFETCH(int, size);
+    const std::vector<Kolab::Freebusy> fbList = createFreebusyLists(size);
+
+    QElapsedTimer timer;
+    timer.start();
+    Kolab::FreebusyUtils::aggregateFreeBusy(fbList, "group@example.org", "group");
+    report("aggregateFreeBusy", size, timer.elapsed());
+    timer.restart();
+    Kolab::FreebusyUtils::aggregateFreeBusy(fbList, "group@example.org", "group", true, true);
+    report("aggregateFreeBusy (merged)", size, timer.elapsed());
+
+    QBENCHMARK {
+        Kolab::FreebusyUtils::aggregateFreeBusy(fbList, "group@example.org", "group");
+    }
+}
+
+void FreebusyBenchmark::toIFBBenchmark_data()
+{
+    addSizes();
+}
+
+void FreebusyBenchmark::toIFBBenchmark()
+{
+    QFETCH(int, size);
+    const Kolab::Freebusy fb = Kolab::FreebusyUtils::aggregateFreeBusy(createFreebusyLists(size), "group@example.org", "group", false);
+
+    QElapsedTimer timer;
+    timer.start();
+    Kolab::FreebusyUtils::toIFB(fb);
+    report("toIFB", size, timer.elapsed());
+
+    QBENCHMARK {
+        Kolab::FreebusyUtils::toIFB(fb);
+    }
+}
+
+QTEST_MAIN( FreebusyBenchmark )
+
+#include "freebusybenchmark.moc"
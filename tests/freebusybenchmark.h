@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2012  Christian Mollekopf <mollekopf@kolabsys.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREEBUSYBENCHMARK_H
+#define FREEBUSYBENCHMARK_H
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+
+/**
+ * Freebusy benchmarks on synthetic calendars.
+ *
+ * The calendars contain a mix of single, recurring and all-day events in various timezones.
+ * Calendars with 1M events are only generated if FREEBUSY_BENCHMARK_LARGE is set in the environment.
+ */
+class FreebusyBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void generateFreeBusyBenchmark_data();
+    void generateFreeBusyBenchmark();
+
+    void aggregateFreeBusyBenchmark_data();
+    void aggregateFreeBusyBenchmark();
+
+    void toIFBBenchmark_data();
+    void toIFBBenchmark();
+};
+
+#endif
@@ -22,6 +22,9 @@
 
 #include <QTest>
 #include "freebusy/freebusy.h"
+#include "freebusy/availability.h"
+#include "conversion/kcalconversion.h"
+#include "conversion/commonconversion.h"
 #include <kolabfreebusy.h>
 
 #include <iostream>
@@ -131,6 +134,461 @@ void FreebusyTest::testFB()
     std::cout << Kolab::FreebusyUtils::toIFB(fb);
 }
 
+static Kolab::Event createRecurringEvent(const Kolab::cDateTime &start, const Kolab::cDateTime &end, Kolab::RecurrenceRule::Frequency freq, int count, const Kolab::cDateTime &until = Kolab::cDateTime())
+{
+    Kolab::Event event = createEvent(start, end);
+    Kolab::RecurrenceRule rrule;
+    rrule.setFrequency(freq);
+    rrule.setInterval(1);
+    if (until.isValid()) {
+        rrule.setEnd(until);
+    } else {
+        rrule.setCount(count);
+    }
+    event.setRecurrenceRule(rrule);
+    return event;
+}
+
+void FreebusyTest::testNativeGenerator_data()
+{
+    QTest::addColumn<Kolab::cDateTime>( "start" );
+    QTest::addColumn<Kolab::cDateTime>( "end" );
+    QTest::addColumn< std::vector<Kolab::Event> >( "events" );
+
+    const Kolab::cDateTime start(2012,3,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,4,30,0,0,0,true);
+    {
+        std::vector<Kolab::Event> events;
+        events.push_back(createEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true)));
+        events.push_back(createEvent(Kolab::cDateTime(2012,2,28,10,0,0,true), Kolab::cDateTime(2012,3,2,11,0,0,true)));
+        events.push_back(createEvent(Kolab::cDateTime(2012,4,29,10,0,0,true), Kolab::cDateTime(2012,5,2,11,0,0,true)));
+        events.push_back(createEvent(Kolab::cDateTime(2012,2,28,10,0,0,true), Kolab::cDateTime(2012,5,2,11,0,0,true)));
+        events.push_back(createEvent(Kolab::cDateTime(2012,1,28,10,0,0,true), Kolab::cDateTime(2012,1,29,11,0,0,true)));
+        Kolab::Event noEnd = createEvent(Kolab::cDateTime(2012,3,6,10,0,0,true), Kolab::cDateTime());
+        events.push_back(noEnd);
+        QTest::newRow("single") << start << end << events;
+    }
+    {
+        std::vector<Kolab::Event> events;
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,2,20,10,0,0,true), Kolab::cDateTime(2012,2,20,11,0,0,true), Kolab::RecurrenceRule::Daily, 20));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,2,20,23,0,0,true), Kolab::cDateTime(2012,2,21,1,0,0,true), Kolab::RecurrenceRule::Daily, 0));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2011,2,20,10,0,0,true), Kolab::cDateTime(2011,2,20,11,0,0,true), Kolab::RecurrenceRule::Weekly, 0, Kolab::cDateTime(2012,4,2,10,0,0,true)));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,5,20,10,0,0,true), Kolab::cDateTime(2012,5,20,11,0,0,true), Kolab::RecurrenceRule::Daily, 0, Kolab::cDateTime(2012,4,2,10,0,0,true)));
+        QTest::newRow("utc recurrence") << start << end << events;
+    }
+    {
+        Kolab::cDateTime zurichStart(2012,3,20,9,0,0);
+        zurichStart.setTimezone("Europe/Zurich");
+        Kolab::cDateTime zurichEnd(2012,3,20,10,30,0);
+        zurichEnd.setTimezone("Europe/Zurich");
+        std::vector<Kolab::Event> events;
+        events.push_back(createRecurringEvent(zurichStart, zurichEnd, Kolab::RecurrenceRule::Daily, 30));
+        events.push_back(createRecurringEvent(zurichStart, zurichEnd, Kolab::RecurrenceRule::Weekly, 0));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,3,20,9,0,0), Kolab::cDateTime(2012,3,20,10,0,0), Kolab::RecurrenceRule::Daily, 10));
+        QTest::newRow("timezone recurrence") << start << end << events;
+    }
+    {
+        Kolab::cDateTime berlinStart(2000,1,1,9,0,0);
+        berlinStart.setTimezone("Europe/Berlin");
+        Kolab::cDateTime berlinEnd(2000,1,1,10,0,0);
+        berlinEnd.setTimezone("Europe/Berlin");
+        std::vector<Kolab::Event> events;
+        events.push_back(createRecurringEvent(berlinStart, berlinEnd, Kolab::RecurrenceRule::Daily, 0));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2000,1,3,23,0,0,true), Kolab::cDateTime(2000,1,4,1,0,0,true), Kolab::RecurrenceRule::Weekly, 0));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2000,1,1,10,0,0,true), Kolab::cDateTime(2000,1,1,11,0,0,true), Kolab::RecurrenceRule::Daily, 5000));
+        QTest::newRow("long running recurrence") << Kolab::cDateTime(2012,3,20,0,0,0,true) << Kolab::cDateTime(2012,4,10,0,0,0,true) << events;
+    }
+    {
+        std::vector<Kolab::Event> events;
+        Kolab::Event byday = createRecurringEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true), Kolab::RecurrenceRule::Weekly, 10);
+        Kolab::RecurrenceRule rrule = byday.recurrenceRule();
+        rrule.setByday(std::vector<Kolab::DayPos>() << Kolab::DayPos(0, Kolab::Monday) << Kolab::DayPos(0, Kolab::Thursday));
+        byday.setRecurrenceRule(rrule);
+        events.push_back(byday);
+        Kolab::Event exdate = createRecurringEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true), Kolab::RecurrenceRule::Daily, 10);
+        exdate.setExceptionDates(std::vector<Kolab::cDateTime>() << Kolab::cDateTime(2012,3,7,10,0,0,true));
+        events.push_back(exdate);
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,3,5), Kolab::cDateTime(2012,3,5), Kolab::RecurrenceRule::Daily, 3));
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true), Kolab::RecurrenceRule::Monthly, 3));
+        Kolab::Event transparent = createEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true));
+        transparent.setTransparency(true);
+        events.push_back(transparent);
+        QTest::newRow("fallback") << start << end << events;
+    }
+    {
+        std::vector<Kolab::Event> events;
+        const Kolab::Event master = createRecurringEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true), Kolab::RecurrenceRule::Daily, 10);
+        events.push_back(master);
+        Kolab::Event moved = createEvent(Kolab::cDateTime(2012,3,7,14,0,0,true), Kolab::cDateTime(2012,3,7,16,0,0,true));
+        moved.setUid(master.uid());
+        moved.setRecurrenceID(Kolab::cDateTime(2012,3,7,10,0,0,true), false);
+        events.push_back(moved);
+        Kolab::Event cancelled = createEvent(Kolab::cDateTime(2012,3,9,10,0,0,true), Kolab::cDateTime(2012,3,9,11,0,0,true));
+        cancelled.setUid(master.uid());
+        cancelled.setRecurrenceID(Kolab::cDateTime(2012,3,9,10,0,0,true), false);
+        cancelled.setTransparency(true);
+        events.push_back(cancelled);
+        Kolab::Event orphan = createEvent(Kolab::cDateTime(2012,3,20,14,0,0,true), Kolab::cDateTime(2012,3,20,16,0,0,true));
+        orphan.setRecurrenceID(Kolab::cDateTime(2012,3,20,10,0,0,true), false);
+        events.push_back(orphan);
+        Kolab::Event allDayMaster = createRecurringEvent(Kolab::cDateTime(2012,3,5), Kolab::cDateTime(2012,3,5), Kolab::RecurrenceRule::Weekly, 5);
+        events.push_back(allDayMaster);
+        Kolab::Event allDayException = createEvent(Kolab::cDateTime(2012,3,13), Kolab::cDateTime(2012,3,13));
+        allDayException.setUid(allDayMaster.uid());
+        allDayException.setRecurrenceID(Kolab::cDateTime(2012,3,12), false);
+        events.push_back(allDayException);
+        QTest::newRow("exceptions") << start << end << events;
+    }
+}
+
+/*
+ * The native implementation must produce the same result as the KCalCore based one.
+ */
+void FreebusyTest::testNativeGenerator()
+{
+    QFETCH(Kolab::cDateTime, start);
+    QFETCH(Kolab::cDateTime, end);
+    QFETCH(std::vector<Kolab::Event>, events);
+
+    QList<KCalCore::Event::Ptr> list;
+    foreach (const Kolab::Event &e, events) {
+        list.append(Kolab::Conversion::toKCalCore(e));
+    }
+    KCalCore::Person::Ptr person(new KCalCore::Person("dummyname", "dummyemail"));
+    const Kolab::Freebusy expected = Kolab::FreebusyUtils::generateFreeBusy(list, Kolab::Conversion::toDate(start), Kolab::Conversion::toDate(end), person);
+    const Kolab::Freebusy fb = Kolab::FreebusyUtils::generateFreeBusy(events, start, end);
+
+    QCOMPARE(fb.start(), expected.start());
+    QCOMPARE(fb.end(), expected.end());
+    QCOMPARE(fb.organizer(), expected.organizer());
+    QCOMPARE((int)fb.periods().size(), (int)expected.periods().size());
+    for (std::size_t i = 0; i < expected.periods().size(); i++) {
+        QCOMPARE(fb.periods().at(i), expected.periods().at(i));
+    }
+}
+
+void FreebusyTest::testGenerateFreebusyBenchmark()
+{
+    std::vector<Kolab::Event> events;
+    for (int day = 1; day < 28; day++) {
+        for (int hour = 1; hour < 20; hour+=2) {
+            events.push_back(createEvent(Kolab::cDateTime(2012,5,day,hour,4,4, true), Kolab::cDateTime(2012,5,day,hour+1,4,4, true)));
+        }
+        events.push_back(createRecurringEvent(Kolab::cDateTime(2012,4,day,21,0,0, true), Kolab::cDateTime(2012,4,day,22,0,0, true), Kolab::RecurrenceRule::Weekly, 0));
+    }
+    const Kolab::cDateTime start(2012,5,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,7,1,0,0,0,true);
+
+    QBENCHMARK {
+        Kolab::FreebusyUtils::generateFreeBusy(events, start, end);
+    }
+}
+
+void FreebusyTest::testAggregateMerge()
+{
+    Kolab::FreebusyPeriod busy1;
+    busy1.setType(Kolab::FreebusyPeriod::Busy);
+    busy1.setEvent("uid1", "summary1", "location1");
+    busy1.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,1,12,0,0,true), Kolab::cDateTime(2012,5,1,14,0,0,true))
+                                                  << Kolab::Period(Kolab::cDateTime(2012,5,1,8,0,0,true), Kolab::cDateTime(2012,5,1,9,0,0,true)));
+    Kolab::FreebusyPeriod tentative;
+    tentative.setType(Kolab::FreebusyPeriod::Tentative);
+    tentative.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,1,9,0,0,true), Kolab::cDateTime(2012,5,1,10,0,0,true)));
+    Kolab::Freebusy fb1;
+    fb1.setStart(Kolab::cDateTime(2012,5,1,0,0,0,true));
+    fb1.setEnd(Kolab::cDateTime(2012,6,1,0,0,0,true));
+    fb1.setPeriods(std::vector<Kolab::FreebusyPeriod>() << busy1 << tentative);
+
+    Kolab::FreebusyPeriod busy2;
+    busy2.setType(Kolab::FreebusyPeriod::Busy);
+    busy2.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,1,13,0,0,true), Kolab::cDateTime(2012,5,1,15,0,0,true)) //overlapping
+                                                  << Kolab::Period(Kolab::cDateTime(2012,5,1,9,0,0,true), Kolab::cDateTime(2012,5,1,10,0,0,true)) //adjacent
+                                                  << Kolab::Period(Kolab::cDateTime(2012,5,1,12,30,0,true), Kolab::cDateTime(2012,5,1,13,0,0,true)) //contained
+                                                  << Kolab::Period(Kolab::cDateTime(2012,5,2,9,0,0,true), Kolab::cDateTime(2012,5,2,10,0,0,true)));
+    Kolab::Freebusy fb2;
+    fb2.setStart(Kolab::cDateTime(2012,5,1,0,0,0,true));
+    fb2.setEnd(Kolab::cDateTime(2012,6,1,0,0,0,true));
+    fb2.setPeriods(std::vector<Kolab::FreebusyPeriod>() << busy2);
+
+    const Kolab::Freebusy result = Kolab::FreebusyUtils::aggregateFreeBusy(std::vector<Kolab::Freebusy>() << fb1 << fb2, "mail@example.org", "name", true, true);
+
+    Kolab::FreebusyPeriod expectedBusy;
+    expectedBusy.setType(Kolab::FreebusyPeriod::Busy);
+    expectedBusy.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,1,8,0,0,true), Kolab::cDateTime(2012,5,1,10,0,0,true))
+                                                         << Kolab::Period(Kolab::cDateTime(2012,5,1,12,0,0,true), Kolab::cDateTime(2012,5,1,15,0,0,true))
+                                                         << Kolab::Period(Kolab::cDateTime(2012,5,2,9,0,0,true), Kolab::cDateTime(2012,5,2,10,0,0,true)));
+    QCOMPARE((int)result.periods().size(), 2);
+    QCOMPARE(result.periods().at(0), expectedBusy);
+    QCOMPARE(result.periods().at(1), tentative);
+    QCOMPARE(result.start(), Kolab::cDateTime(2012,5,1,0,0,0,true));
+    QCOMPARE(result.end(), Kolab::cDateTime(2012,6,1,0,0,0,true));
+}
+
+void FreebusyTest::testFreeWindows()
+{
+    const Kolab::cDateTime start(2012,5,1,8,0,0,true);
+    const Kolab::cDateTime end(2012,5,1,18,0,0,true);
+
+    std::vector<Kolab::Event> events1;
+    events1.push_back(createEvent(Kolab::cDateTime(2012,5,1,9,0,0,true), Kolab::cDateTime(2012,5,1,10,0,0,true)));
+    events1.push_back(createEvent(Kolab::cDateTime(2012,5,1,13,10,0,true), Kolab::cDateTime(2012,5,1,14,0,0,true))); //Not aligned to the slots
+    std::vector<Kolab::Event> events2;
+    events2.push_back(createEvent(Kolab::cDateTime(2012,5,1,7,0,0,true), Kolab::cDateTime(2012,5,1,8,30,0,true)));
+    events2.push_back(createEvent(Kolab::cDateTime(2012,5,1,10,0,0,true), Kolab::cDateTime(2012,5,1,12,30,0,true)));
+    events2.push_back(createEvent(Kolab::cDateTime(2012,5,1,17,0,0,true), Kolab::cDateTime(2012,5,1,20,0,0,true)));
+
+    std::vector<Kolab::Freebusy> fbList;
+    fbList.push_back(Kolab::FreebusyUtils::generateFreeBusy(events1, start, end));
+    fbList.push_back(Kolab::FreebusyUtils::generateFreeBusy(events2, start, end));
+
+    const std::vector<Kolab::Period> windows = Kolab::FreebusyUtils::findFreeWindows(fbList, start, end, 30 * 60);
+    QCOMPARE((int)windows.size(), 3);
+    QCOMPARE(windows.at(0), Kolab::Period(Kolab::cDateTime(2012,5,1,8,30,0,true), Kolab::cDateTime(2012,5,1,9,0,0,true)));
+    QCOMPARE(windows.at(1), Kolab::Period(Kolab::cDateTime(2012,5,1,12,30,0,true), Kolab::cDateTime(2012,5,1,13,0,0,true)));
+    QCOMPARE(windows.at(2), Kolab::Period(Kolab::cDateTime(2012,5,1,14,0,0,true), Kolab::cDateTime(2012,5,1,17,0,0,true)));
+
+    QCOMPARE((int)Kolab::FreebusyUtils::findFreeWindows(fbList, start, end, 2 * 60 * 60).size(), 1);
+
+    //Only busy if both are busy
+    Kolab::FreebusyUtils::AvailabilityMap map1(start, end);
+    map1.addFreebusy(fbList.at(0));
+    Kolab::FreebusyUtils::AvailabilityMap map2(start, end);
+    map2.addFreebusy(fbList.at(1));
+    QVERIFY(map1.intersect(map2));
+    const std::vector<Kolab::Period> anyFree = map1.findFreeWindows(0);
+    QCOMPARE((int)anyFree.size(), 1);
+    QCOMPARE(anyFree.at(0), Kolab::Period(start, end));
+
+    Kolab::FreebusyUtils::AvailabilityMap otherWindow(start, end, 5 * 60);
+    QVERIFY(!map1.unite(otherWindow));
+}
+
+void FreebusyTest::testFreebusyCache()
+{
+    const Kolab::cDateTime start(2012,5,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,6,1,0,0,0,true);
+
+    Kolab::Event event1 = createEvent(Kolab::cDateTime(2012,5,2,9,0,0,true), Kolab::cDateTime(2012,5,2,10,0,0,true));
+    event1.setUid("uid1");
+    Kolab::Event event2 = createRecurringEvent(Kolab::cDateTime(2012,4,2,9,0,0,true), Kolab::cDateTime(2012,4,2,10,0,0,true), Kolab::RecurrenceRule::Weekly, 0);
+    event2.setUid("uid2");
+    Kolab::Event event3 = createEvent(Kolab::cDateTime(2012,7,2,9,0,0,true), Kolab::cDateTime(2012,7,2,10,0,0,true));
+    event3.setUid("uid3");
+
+    Kolab::FreebusyUtils::FreebusyCache cache(start, end);
+    cache.addEvent(event2);
+    cache.addEvent(event1);
+    cache.addEvent(event3);
+    {
+        const Kolab::Freebusy expected = Kolab::FreebusyUtils::generateFreeBusy(std::vector<Kolab::Event>() << event1 << event2 << event3, start, end);
+        const Kolab::Freebusy fb = cache.freebusy();
+        QCOMPARE(fb.start(), expected.start());
+        QCOMPARE(fb.end(), expected.end());
+        QCOMPARE((int)fb.periods().size(), 2);
+        QCOMPARE(fb.periods().at(0), expected.periods().at(0));
+        QCOMPARE(fb.periods().at(1), expected.periods().at(1));
+    }
+
+    //Modification
+    event1.setEnd(Kolab::cDateTime(2012,5,2,11,0,0,true));
+    cache.addEvent(event1);
+    event3.setStart(Kolab::cDateTime(2012,5,3,9,0,0,true));
+    event3.setEnd(Kolab::cDateTime(2012,5,3,10,0,0,true));
+    cache.addEvent(event3);
+    {
+        const Kolab::Freebusy expected = Kolab::FreebusyUtils::generateFreeBusy(std::vector<Kolab::Event>() << event1 << event2 << event3, start, end);
+        const Kolab::Freebusy fb = cache.freebusy();
+        QCOMPARE((int)fb.periods().size(), 3);
+        for (std::size_t i = 0; i < expected.periods().size(); i++) {
+            QCOMPARE(fb.periods().at(i), expected.periods().at(i));
+        }
+    }
+
+    //Removal
+    cache.removeEvent("uid2");
+    event3.setTransparency(true);
+    cache.addEvent(event3);
+    {
+        const Kolab::Freebusy fb = cache.freebusy();
+        QCOMPARE((int)fb.periods().size(), 1);
+        QCOMPARE(fb.periods().at(0).eventUid(), std::string("uid1"));
+    }
+
+    //Removal of a single exception, the master fills the occurrence again
+    Kolab::Event master = createRecurringEvent(Kolab::cDateTime(2012,5,10,14,0,0,true), Kolab::cDateTime(2012,5,10,15,0,0,true), Kolab::RecurrenceRule::Daily, 3);
+    master.setUid("uid4");
+    Kolab::Event exception = createEvent(Kolab::cDateTime(2012,5,11,16,0,0,true), Kolab::cDateTime(2012,5,11,17,0,0,true));
+    exception.setUid("uid4");
+    exception.setRecurrenceID(Kolab::cDateTime(2012,5,11,14,0,0,true), false);
+    cache.addEvent(master);
+    cache.addEvent(exception);
+    cache.removeEvent("uid4", exception.recurrenceID());
+    {
+        const Kolab::Freebusy expected = Kolab::FreebusyUtils::generateFreeBusy(std::vector<Kolab::Event>() << event1 << master, start, end);
+        const Kolab::Freebusy fb = cache.freebusy();
+        QCOMPARE((int)fb.periods().size(), 2);
+        QCOMPARE(fb.periods().at(0), expected.periods().at(0));
+        QCOMPARE(fb.periods().at(1), expected.periods().at(1));
+    }
+
+    //Removal of the master keeps the exceptions
+    cache.addEvent(exception);
+    cache.removeEvent("uid4", Kolab::cDateTime());
+    {
+        const Kolab::Freebusy fb = cache.freebusy();
+        QCOMPARE((int)fb.periods().size(), 2);
+        QCOMPARE(fb.periods().at(1).eventUid(), std::string("uid4"));
+        QCOMPARE((int)fb.periods().at(1).periods().size(), 1);
+        QCOMPARE(fb.periods().at(1).periods().at(0).start, exception.start());
+    }
+
+    //The entry is dropped with the last exception
+    cache.removeEvent("uid4", exception.recurrenceID());
+    QCOMPARE((int)cache.freebusy().periods().size(), 1);
+}
+
+void FreebusyTest::testBatchGeneration()
+{
+    std::vector<Kolab::FreebusyUtils::FreebusyRequest> requests;
+    for (int user = 0; user < 50; user++) {
+        Kolab::FreebusyUtils::FreebusyRequest request;
+        request.organizerEmail = QString("user%1@example.org").arg(user).toStdString();
+        request.start = Kolab::cDateTime(2012,5,1,0,0,0,true);
+        request.end = Kolab::cDateTime(2012,6,1,0,0,0,true);
+        for (int day = 1; day < 28; day += (user % 3) + 1) {
+            request.events.push_back(createEvent(Kolab::cDateTime(2012,5,day,9,0,0,true), Kolab::cDateTime(2012,5,day,10,0,0,true)));
+        }
+        request.events.push_back(createRecurringEvent(Kolab::cDateTime(2012,4,user % 28 + 1,12,0,0,true), Kolab::cDateTime(2012,4,user % 28 + 1,13,0,0,true), Kolab::RecurrenceRule::Daily, user));
+        //Requests with timezones mixed in between, which can't be processed concurrently
+        if (user % 4 == 0) {
+            request.events.push_back(createRecurringEvent(Kolab::cDateTime("Europe/Berlin",2012,4,user % 28 + 1,15,0,0), Kolab::cDateTime("Europe/Berlin",2012,4,user % 28 + 1,16,0,0), Kolab::RecurrenceRule::Weekly, 0));
+            request.events.push_back(createEvent(Kolab::cDateTime(2012,5,user % 28 + 1), Kolab::cDateTime(2012,5,user % 28 + 1)));
+        }
+        requests.push_back(request);
+    }
+
+    const std::vector<Kolab::Freebusy> results = Kolab::FreebusyUtils::generateFreeBusy(requests);
+    QCOMPARE(results.size(), requests.size());
+    for (std::size_t i = 0; i < requests.size(); i++) {
+        const Kolab::FreebusyUtils::FreebusyRequest &request = requests.at(i);
+        const Kolab::Freebusy expected = Kolab::FreebusyUtils::generateFreeBusy(request.events, request.start, request.end);
+        QCOMPARE(results.at(i).organizer().email(), request.organizerEmail);
+        QCOMPARE((int)results.at(i).periods().size(), (int)expected.periods().size());
+        for (std::size_t p = 0; p < expected.periods().size(); p++) {
+            QCOMPARE(results.at(i).periods().at(p), expected.periods().at(p));
+        }
+    }
+}
+
+void FreebusyTest::testWriteIFB()
+{
+    Kolab::FreebusyPeriod busy;
+    busy.setType(Kolab::FreebusyPeriod::Busy);
+    busy.setEvent("uid1", "Summary with ;:, and \u00e4\u00f6\u00fc, long enough to require folding of the line", "location");
+    busy.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,1,9,0,0,true), Kolab::cDateTime(2012,5,1,10,0,0,true)));
+    Kolab::FreebusyPeriod tentative;
+    tentative.setType(Kolab::FreebusyPeriod::Tentative);
+    tentative.setPeriods(std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,5,2,9,0,0,true), Kolab::cDateTime(2012,5,2,10,0,0,true)));
+
+    Kolab::Freebusy fb;
+    fb.setUid("fbuid");
+    fb.setStart(Kolab::cDateTime(2012,5,1,0,0,0,true));
+    fb.setEnd(Kolab::cDateTime(2012,6,1,0,0,0,true));
+    fb.setTimestamp(Kolab::cDateTime(2012,4,1,0,0,0,true));
+    fb.setOrganizer(Kolab::ContactReference(Kolab::ContactReference::EmailReference, "mail@example.org", "Doe, John"));
+    fb.setPeriods(std::vector<Kolab::FreebusyPeriod>() << busy << tentative);
+
+    const QString ifb = QString::fromUtf8(Kolab::FreebusyUtils::toIFB(fb).c_str());
+    const QByteArray unfolded = ifb.toUtf8().replace("\r\n ", "");
+    QVERIFY(ifb.startsWith("BEGIN:VCALENDAR\r\n"));
+    QVERIFY(unfolded.contains("ORGANIZER;CN=\"Doe, John\":MAILTO:mail@example.org\r\n"));
+    QVERIFY(unfolded.contains("DTSTART:20120501T000000Z\r\n"));
+    QVERIFY(unfolded.contains("DTEND:20120601T000000Z\r\n"));
+    QVERIFY(unfolded.contains("FBTYPE=BUSY;X-UID=" + QByteArray("uid1").toBase64() + ";X-SUMMARY=" + QByteArray(busy.eventSummary().c_str()).toBase64()));
+    QVERIFY(unfolded.contains(":20120501T090000Z/20120501T100000Z\r\n"));
+    QVERIFY(unfolded.contains("FREEBUSY;FBTYPE=BUSY-TENTATIVE:20120502T090000Z/20120502T100000Z\r\n"));
+    Q_FOREACH (const QByteArray &line, ifb.toUtf8().split('\n')) {
+        QVERIFY(line.size() <= 76); //Including the \r
+    }
+
+    std::string appended("prefix");
+    Kolab::FreebusyUtils::writeIFB(fb, appended);
+    QCOMPARE(appended, "prefix" + Kolab::FreebusyUtils::toIFB(fb));
+}
+
+void FreebusyTest::testRecurrenceExceptions()
+{
+    const Kolab::Event master = createRecurringEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true), Kolab::RecurrenceRule::Daily, 3);
+    Kolab::Event moved = createEvent(Kolab::cDateTime(2012,3,6,14,0,0,true), Kolab::cDateTime(2012,3,6,16,0,0,true));
+    moved.setUid(master.uid());
+    moved.setRecurrenceID(Kolab::cDateTime(2012,3,6,10,0,0,true), false);
+
+    //The exception comes first, it is applied nevertheless
+    const Kolab::Freebusy fb = Kolab::FreebusyUtils::generateFreeBusy(std::vector<Kolab::Event>() << moved << master, Kolab::cDateTime(2012,3,1,0,0,0,true), Kolab::cDateTime(2012,4,1,0,0,0,true));
+    QCOMPARE((int)fb.periods().size(), 2);
+    const std::vector<Kolab::Period> masterPeriods = std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true))
+                                                                                 << Kolab::Period(Kolab::cDateTime(2012,3,7,10,0,0,true), Kolab::cDateTime(2012,3,7,11,0,0,true));
+    QCOMPARE(fb.periods().at(0).periods(), masterPeriods);
+    QCOMPARE(fb.periods().at(1).periods(), std::vector<Kolab::Period>() << Kolab::Period(moved.start(), moved.end()));
+
+    //The cache applies exceptions that are added later
+    Kolab::FreebusyUtils::FreebusyCache cache(Kolab::cDateTime(2012,3,1,0,0,0,true), Kolab::cDateTime(2012,4,1,0,0,0,true));
+    cache.addEvent(master);
+    QCOMPARE((int)cache.freebusy().periods().at(0).periods().size(), 3);
+    cache.addEvent(moved);
+    QCOMPARE((int)cache.freebusy().periods().size(), 2);
+    QCOMPARE(cache.freebusy().periods().at(0).periods(), masterPeriods);
+}
+
+void FreebusyTest::testRecurrenceWindow()
+{
+    //Starts long before the window, the first occurrence in the window started the day before
+    const Kolab::Event event = createRecurringEvent(Kolab::cDateTime(2000,1,1,23,0,0,true), Kolab::cDateTime(2000,1,2,1,0,0,true), Kolab::RecurrenceRule::Daily, 0);
+    const Kolab::Freebusy fb = Kolab::FreebusyUtils::generateFreeBusy(std::vector<Kolab::Event>() << event, Kolab::cDateTime(2012,3,1,0,0,0,true), Kolab::cDateTime(2012,3,3,0,0,0,true));
+    QCOMPARE((int)fb.periods().size(), 1);
+    const std::vector<Kolab::Period> expected = std::vector<Kolab::Period>() << Kolab::Period(Kolab::cDateTime(2012,3,1,0,0,0,true), Kolab::cDateTime(2012,3,1,1,0,0,true))
+                                                                           << Kolab::Period(Kolab::cDateTime(2012,3,1,23,0,0,true), Kolab::cDateTime(2012,3,2,1,0,0,true))
+                                                                           << Kolab::Period(Kolab::cDateTime(2012,3,2,23,0,0,true), Kolab::cDateTime(2012,3,3,0,0,0,true));
+    QCOMPARE(fb.periods().at(0).periods(), expected);
+}
+
+void FreebusyTest::testCompactGeneration()
+{
+    const Kolab::Event busy1 = createEvent(Kolab::cDateTime(2012,3,5,10,0,0,true), Kolab::cDateTime(2012,3,5,11,0,0,true));
+    Kolab::Event tentative = createEvent(Kolab::cDateTime(2012,3,5,10,30,0,true), Kolab::cDateTime(2012,3,5,12,0,0,true));
+    tentative.setStatus(Kolab::StatusTentative);
+    const Kolab::Event busy2 = createEvent(Kolab::cDateTime(2012,3,5,10,45,0,true), Kolab::cDateTime(2012,3,5,13,0,0,true));
+    Kolab::Event cancelled = createEvent(Kolab::cDateTime(2012,3,5,14,0,0,true), Kolab::cDateTime(2012,3,5,15,0,0,true));
+    cancelled.setStatus(Kolab::StatusCancelled);
+    Kolab::Event transparent = createEvent(Kolab::cDateTime(2012,3,5,16,0,0,true), Kolab::cDateTime(2012,3,5,17,0,0,true));
+    transparent.setTransparency(true);
+    const std::vector<Kolab::Event> events = std::vector<Kolab::Event>() << busy1 << tentative << busy2 << cancelled << transparent;
+    const Kolab::cDateTime start(2012,3,1,0,0,0,true);
+    const Kolab::cDateTime end(2012,4,1,0,0,0,true);
+
+    //Without merging the output is the same as before the busy types were supported
+    const Kolab::Freebusy fb = Kolab::FreebusyUtils::generateFreeBusy(events, start, end);
+    QCOMPARE((int)fb.periods().size(), 4);
+    Q_FOREACH (const Kolab::FreebusyPeriod &period, fb.periods()) {
+        QCOMPARE(period.type(), Kolab::FreebusyPeriod::Busy);
+    }
+    QCOMPARE(fb.periods().at(1).eventUid(), tentative.uid());
+    QCOMPARE(fb.periods().at(3).eventUid(), cancelled.uid());
+
+    const Kolab::Freebusy simpleFb = Kolab::FreebusyUtils::generateFreeBusy(events, start, end, true);
+    QCOMPARE((int)simpleFb.periods().size(), 4);
+    QCOMPARE(simpleFb.periods().at(1).type(), Kolab::FreebusyPeriod::Busy);
+    QVERIFY(simpleFb.periods().at(1).eventUid().empty());
+
+    const Kolab::Freebusy compactFb = Kolab::FreebusyUtils::generateFreeBusy(events, start, end, true, true);
+    QCOMPARE((int)compactFb.periods().size(), 2);
+    QCOMPARE(compactFb.periods().at(0).type(), Kolab::FreebusyPeriod::Busy);
+    QCOMPARE(compactFb.periods().at(0).periods(), std::vector<Kolab::Period>() << Kolab::Period(busy1.start(), busy2.end()));
+    QCOMPARE(compactFb.periods().at(1).type(), Kolab::FreebusyPeriod::Tentative);
+    QCOMPARE(compactFb.periods().at(1).periods(), std::vector<Kolab::Period>() << Kolab::Period(tentative.start(), tentative.end()));
+    QVERIFY(compactFb.periods().at(0).eventUid().empty());
+}
+
 // void FreebusyTest::testHonorTimeFrame()
 // {
 // 
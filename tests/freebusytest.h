@@ -27,6 +27,17 @@ private slots:
 
     void testFB_data();
     void testFB();
+    void testNativeGenerator_data();
+    void testNativeGenerator();
+    void testGenerateFreebusyBenchmark();
+    void testAggregateMerge();
+    void testFreeWindows();
+    void testFreebusyCache();
+    void testBatchGeneration();
+    void testWriteIFB();
+    void testRecurrenceExceptions();
+    void testRecurrenceWindow();
+    void testCompactGeneration();
 };
 
 #endif // FREEBUSYTEST_H
@@ -20,7 +20,10 @@
 #include <QTest>
 
 #include "kolabformat/kolabobject.h"
+#include "mime/mimeutils.h"
+#include "testutils.h"
 #include <kdebug.h>
+#include <ksystemtimezone.h>
 #include <kolabformat/errorhandler.h>
 
 void KolabObjectTest::preserveLatin1()
@@ -53,6 +56,148 @@ void KolabObjectTest::preserveUnicode()
     QCOMPARE(readEvent->summary(), summary);
 }
 
+void KolabObjectTest::preserveAttachment()
+{
+    QByteArray data;
+    for (int i = 0; i < 256*64; i++) {
+        data.append(static_cast<char>(i % 256));
+    }
+    KCalCore::Event::Ptr event(new KCalCore::Event());
+    event->setDtStart(KDateTime(QDate(2012,11,11)));
+    KCalCore::Attachment::Ptr attachment(new KCalCore::Attachment(QByteArray(), QLatin1String("application/octet-stream")));
+    attachment->setDecodedData(data);
+    attachment->setLabel(QLatin1String("binary"));
+    event->addAttachment(attachment);
+
+    for (int v = Kolab::KolabV2; v <= Kolab::KolabV3; v++) {
+        KMime::Message::Ptr msg = Kolab::KolabObjectWriter::writeEvent(event, static_cast<Kolab::Version>(v));
+        KCalCore::Event::Ptr readEvent = Kolab::KolabObjectReader(msg).getEvent();
+        QVERIFY(readEvent);
+        QCOMPARE(readEvent->attachments().size(), 1);
+        QCOMPARE(readEvent->attachments().first()->decodedData(), data);
+        QCOMPARE(readEvent->attachments().first()->data(), attachment->data());
+        QCOMPARE(readEvent->attachments().first()->label(), QString::fromLatin1("binary"));
+    }
+}
+
+void KolabObjectTest::attachmentPolicy()
+{
+    const QByteArray data("attachment content");
+    KCalCore::Event::Ptr event(new KCalCore::Event());
+    event->setDtStart(KDateTime(QDate(2012,11,11)));
+    KCalCore::Attachment::Ptr attachment(new KCalCore::Attachment(QByteArray(), QLatin1String("text/plain")));
+    attachment->setDecodedData(data);
+    attachment->setLabel(QLatin1String("text"));
+    event->addAttachment(attachment);
+    const KMime::Message::Ptr msg = Kolab::KolabObjectWriter::writeEvent(event);
+
+    Kolab::KolabObjectReader referencingReader;
+    referencingReader.setAttachmentPolicy(Kolab::KolabObjectReader::ReferenceAttachments);
+    QCOMPARE(referencingReader.parseMimeMessage(msg), Kolab::EventObject);
+    const KCalCore::Attachment::List referenced = referencingReader.getEvent()->attachments();
+    QCOMPARE(referenced.size(), 1);
+    QVERIFY(referenced.first()->uri().startsWith(QLatin1String("cid:")));
+    QCOMPARE(referenced.first()->mimeType(), QString::fromLatin1("text/plain"));
+    QCOMPARE(referenced.first()->label(), QString::fromLatin1("text"));
+    QCOMPARE(referenced.first()->size(), static_cast<uint>(data.size()));
+    QCOMPARE(referencingReader.getAttachmentData(referenced.first()->uri()), data);
+    QVERIFY(!Kolab::KolabObjectWriter::writeEvent(referencingReader.getEvent()));
+    QVERIFY(Kolab::ErrorHandler::errorOccured());
+
+    Kolab::KolabObjectReader skippingReader;
+    skippingReader.setAttachmentPolicy(Kolab::KolabObjectReader::SkipAttachments);
+    QCOMPARE(skippingReader.parseMimeMessage(msg), Kolab::EventObject);
+    const KCalCore::Attachment::List skipped = skippingReader.getEvent()->attachments();
+    QCOMPARE(skipped.size(), 1);
+    QCOMPARE(skipped.first()->uri(), referenced.first()->uri());
+    QVERIFY(skipped.first()->data().isEmpty());
+    QVERIFY(!Kolab::KolabObjectWriter::writeEvent(skippingReader.getEvent()));
+    QVERIFY(Kolab::ErrorHandler::errorOccured());
+
+    Kolab::KolabObjectReader loadingReader(msg);
+    QVERIFY(Kolab::KolabObjectWriter::writeEvent(loadingReader.getEvent()));
+}
+
+void KolabObjectTest::attachmentReferenceSize()
+{
+    const QByteArray data("attachment content");
+    KMime::Message::Ptr msg(new KMime::Message);
+    msg->contentType()->setMimeType("multipart/mixed");
+    msg->addContent(Kolab::Mime::createAttachmentPart("decoded@kolab", QLatin1String("text/plain"), QLatin1String("decoded"), data));
+    KMime::Content *malformed = Kolab::Mime::createAttachmentPart("malformed@kolab", QLatin1String("text/plain"), QLatin1String("malformed"), QByteArray());
+    malformed->setBody("==");
+    malformed->contentTransferEncoding()->setDecoded(false);
+    msg->addContent(malformed);
+
+    KCalCore::Event::Ptr event(new KCalCore::Event());
+    event->addAttachment(KCalCore::Attachment::Ptr(new KCalCore::Attachment(QLatin1String("cid:decoded@kolab"))));
+    event->addAttachment(KCalCore::Attachment::Ptr(new KCalCore::Attachment(QLatin1String("cid:malformed@kolab"))));
+    Kolab::Mime::getAttachmentReferencesById(event, Kolab::Mime::PartIndex(msg));
+    QCOMPARE(event->attachments().at(0)->size(), static_cast<uint>(data.size()));
+    QCOMPARE(event->attachments().at(1)->size(), static_cast<uint>(0));
+}
+
+void KolabObjectTest::partIndex()
+{
+    bool ok = false;
+    const KMime::Message::Ptr msg = readMimeFile(getPath("v3/event/complex.ics.mime"), ok);
+    QVERIFY(ok);
+    const Kolab::Mime::PartIndex index(msg);
+    Q_FOREACH (KMime::Content *c, msg->contents()) {
+        const QByteArray mimeType = c->contentType()->mimeType();
+        QCOMPARE(index.findByType(mimeType), Kolab::Mime::findContentByType(msg, mimeType));
+
+        QByteArray type;
+        QByteArray expectedType;
+        QCOMPARE(index.findByName(c->contentType()->name(), type), Kolab::Mime::findContentByName(msg, c->contentType()->name(), expectedType));
+        QCOMPARE(type, expectedType);
+    }
+    QByteArray type;
+    QString name;
+    KMime::Content *attachment = index.findById("7313173.zaagFSsPPv@kolab.resource.akonadi", type, name);
+    QVERIFY(attachment);
+    QCOMPARE(type, QByteArray("image/png"));
+    QCOMPARE(name, QString::fromLatin1("akonadi.png"));
+    QVERIFY(!index.findById("nonexisting@kolab.resource.akonadi", type, name));
+    QVERIFY(!index.findByType("application/nonexisting"));
+}
+
+void KolabObjectTest::sniffHeaders()
+{
+    QFile v3File(getPath("v3/event/complex.ics.mime"));
+    QVERIFY(v3File.open(QFile::ReadOnly));
+    const QByteArray v3Data = v3File.readAll();
+    const Kolab::KolabHeaders v3 = Kolab::sniffKolabHeaders(v3Data.constData(), v3Data.size());
+    bool ok = false;
+    const KMime::Message::Ptr msg = readMimeFile(getPath("v3/event/complex.ics.mime"), ok);
+    QVERIFY(ok);
+    QCOMPARE(v3.type, Kolab::EventObject);
+    QCOMPARE(v3.version, Kolab::KolabV3);
+    QCOMPARE(v3.uid, msg->subject()->asUnicodeString());
+
+    QFile v2File(getPath("v2/event/simple.ics.mime"));
+    QVERIFY(v2File.open(QFile::ReadOnly));
+    const QByteArray v2Data = v2File.readAll();
+    const Kolab::KolabHeaders v2 = Kolab::sniffKolabHeaders(v2Data.constData(), v2Data.size());
+    QCOMPARE(v2.type, Kolab::EventObject);
+    QCOMPARE(v2.version, Kolab::KolabV2);
+    QCOMPARE(v2.uid, QString::fromLatin1("KOrganizer-1353608432.168"));
+
+    //Folded and encoded headers, the body must not be looked at
+    const QByteArray headers("x-kolab-type:\r\n application/x-vnd.kolab.task\r\n"
+                             "X-Kolab-Mime-Version: 3.0\r\n"
+                             "Subject: =?utf-8?q?uid=C3=A4?=\r\n"
+                             "\r\n"
+                             "X-Kolab-Type: application/x-vnd.kolab.event\r\n");
+    const Kolab::KolabHeaders folded = Kolab::sniffKolabHeaders(headers.constData(), headers.size());
+    QCOMPARE(folded.type, Kolab::TodoObject);
+    QCOMPARE(folded.version, Kolab::KolabV3);
+    QCOMPARE(folded.uid, QString::fromUtf8("uid\xc3\xa4"));
+
+    const Kolab::KolabHeaders empty = Kolab::sniffKolabHeaders(0, 0);
+    QCOMPARE(empty.type, Kolab::InvalidObject);
+}
+
 void KolabObjectTest::dontCrashWithEmptyOrganizer()
 {
     KCalCore::Event::Ptr event(new KCalCore::Event());
@@ -167,6 +312,76 @@ void KolabObjectTest::parseRelationMembers()
     }
 }
 
+void KolabObjectTest::batchReader()
+{
+    QList<QByteArray> messages;
+    for (int i = 0; i < 20; i++) {
+        KCalCore::Event::Ptr event(new KCalCore::Event());
+        event->setSummary(QString::fromLatin1("summary%1").arg(i));
+        event->setDtStart(KDateTime(QDate(2012,11,11)));
+        messages << Kolab::KolabObjectWriter::writeEvent(event)->encodedContent();
+    }
+    messages << QByteArray("invalid message");
+    //The xml is parsed concurrently, the error has to be reported for the message nevertheless
+    messages << Kolab::Mime::createMessage(QLatin1String("uid"), QLatin1String("application/calendar+xml"), QLatin1String("application/x-vnd.kolab.event"), "<invalid", true, QString())->encodedContent();
+
+    Kolab::KolabObjectBatchReader batchReader;
+    batchReader.parseMimeMessages(messages);
+    QCOMPARE(batchReader.count(), messages.size());
+    for (int i = 0; i < 20; i++) {
+        QCOMPARE(batchReader.reader(i).getType(), Kolab::EventObject);
+        QCOMPARE(batchReader.reader(i).getEvent()->summary(), QString::fromLatin1("summary%1").arg(i));
+        QCOMPARE(batchReader.error(i), Kolab::ErrorHandler::Debug);
+    }
+    QCOMPARE(batchReader.reader(20).getType(), Kolab::InvalidObject);
+    QCOMPARE(batchReader.error(20), Kolab::ErrorHandler::Critical);
+    QVERIFY(!batchReader.errors(20).isEmpty());
+    QCOMPARE(batchReader.reader(21).getType(), Kolab::InvalidObject);
+    QVERIFY(batchReader.error(21) >= Kolab::ErrorHandler::Error);
+
+    QList<KMime::Message::Ptr> parsedMessages;
+    for (int i = 0; i < 20; i++) {
+        KMime::Message::Ptr msg(new KMime::Message);
+        msg->setContent(messages.at(i));
+        msg->parse();
+        parsedMessages << msg;
+    }
+    batchReader.parseMimeMessages(parsedMessages);
+    QCOMPARE(batchReader.count(), parsedMessages.size());
+    for (int i = 0; i < 20; i++) {
+        QCOMPARE(batchReader.reader(i).getEvent()->summary(), QString::fromLatin1("summary%1").arg(i));
+        QCOMPARE(batchReader.error(i), Kolab::ErrorHandler::Debug);
+    }
+}
+
+/*
+ * Events with timezones use KSystemTimeZones, which must not be accessed concurrently.
+ */
+void KolabObjectTest::batchReaderTimezones()
+{
+    const char *timezones[] = { "Europe/Berlin", "Europe/Zurich", "America/New_York", "Asia/Dubai" };
+    QList<QByteArray> messages;
+    QList<KDateTime> starts;
+    for (int i = 0; i < 40; i++) {
+        KCalCore::Event::Ptr event(new KCalCore::Event());
+        const KDateTime start(QDate(2012,11,i % 28 + 1), QTime(10,0,0), KSystemTimeZones::zone(QString::fromLatin1(timezones[i % 4])));
+        event->setDtStart(start);
+        event->setDtEnd(start.addSecs(3600));
+        starts << start;
+        messages << Kolab::KolabObjectWriter::writeEvent(event, i % 2 ? Kolab::KolabV2 : Kolab::KolabV3)->encodedContent();
+    }
+
+    Kolab::KolabObjectBatchReader batchReader;
+    batchReader.parseMimeMessages(messages);
+    QCOMPARE(batchReader.count(), messages.size());
+    for (int i = 0; i < messages.size(); i++) {
+        QCOMPARE(batchReader.reader(i).getType(), Kolab::EventObject);
+        const KDateTime start = batchReader.reader(i).getEvent()->dtStart();
+        QCOMPARE(start, starts.at(i));
+        QCOMPARE(start.timeZone().name(), starts.at(i).timeZone().name());
+    }
+}
+
 
 
 QTEST_MAIN( KolabObjectTest )
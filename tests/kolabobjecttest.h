@@ -25,9 +25,16 @@ class KolabObjectTest: public QObject
 private slots:
     void preserveLatin1();
     void preserveUnicode();
+    void preserveAttachment();
+    void attachmentPolicy();
+    void attachmentReferenceSize();
+    void partIndex();
+    void sniffHeaders();
     void dontCrashWithEmptyOrganizer();
     void dontCrashWithEmptyIncidence();
     void parseRelationMembers();
+    void batchReader();
+    void batchReaderTimezones();
 };
 
 #endif // KOLABOBJECTTEST_H
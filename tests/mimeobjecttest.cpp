@@ -23,6 +23,7 @@
 #include <fstream>
 #include <sstream>
 #include <QString>
+#include <QFile>
 #include <ksystemtimezone.h>
 
 void MIMEObjectTest::initTestCase()
@@ -50,6 +51,44 @@ void MIMEObjectTest::testEvent(){
     
     QCOMPARE(input.simplified(), qMessage.simplified());
 }
+
+void MIMEObjectTest::testEventAttachment()
+{
+    Kolab::MIMEObject mimeobject;
+
+    std::ifstream t((TESTFILEDIR.toStdString()+"v3/event/complex.ics.mime").c_str());
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+
+    const Kolab::Event event = mimeobject.readEvent(buffer.str());
+    QCOMPARE(event.attachments().size(), static_cast<std::size_t>(1));
+    const Kolab::Attachment attachment = event.attachments().front();
+    QVERIFY(attachment.uri().empty());
+    QVERIFY(!attachment.data().empty());
+    QCOMPARE(attachment.mimetype(), std::string("image/png"));
+    QCOMPARE(attachment.label(), std::string("akonadi.png"));
+
+    //The attachment is written as separate part and resolved again when reading
+    const Kolab::Event result = mimeobject.readEvent(mimeobject.writeEvent(event, Kolab::KolabV3));
+    QCOMPARE(result.attachments().size(), static_cast<std::size_t>(1));
+    QVERIFY(result.attachments().front().data() == attachment.data());
+    QCOMPARE(result.attachments().front().label(), attachment.label());
+}
+
+void MIMEObjectTest::testReadFromBuffer()
+{
+    Kolab::MIMEObject mimeobject;
+
+    QFile file(TESTFILEDIR+"v3/event/complex.ics.mime");
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QByteArray data = file.readAll();
+
+    const Kolab::Event event = mimeobject.readEvent(data.constData(), data.size());
+    QCOMPARE(event.uid(), mimeobject.readEvent(std::string(data.constData(), data.size())).uid());
+    QVERIFY(!event.uid().empty());
+    QCOMPARE(event.attachments().size(), static_cast<std::size_t>(1));
+}
+
 /*
 void MIMEObjectTest::testTodo(){
 
@@ -26,6 +26,8 @@ class MIMEObjectTest: public QObject
 private slots:
     void initTestCase();
     void testEvent();
+    void testEventAttachment();
+    void testReadFromBuffer();
     void testJournal(); 
     void testNote();
     void testContact();
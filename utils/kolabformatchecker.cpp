@@ -76,6 +76,8 @@ int main(int argc, char *argv[])
 
     int returnValue = 0;
 
+    Kolab::ErrorHandler::setConsoleOutput(true);
+
     cout << endl;
 
     for(vector<string>::const_iterator it = inputFiles.begin();